@@ -11,140 +11,124 @@
  *
  */
 
-#include "repowork.h"
+#include <cstring>
 
-typedef int (*blobcmd_t)(git_blob_data *, std::ifstream &);
-blobcmd_t
-blob_find_cmd(std::string &line, std::map<std::string, blobcmd_t> &cmdmap)
-{
-    blobcmd_t cc = NULL;
-    std::map<std::string, blobcmd_t>::iterator c_it;
-    for (c_it = cmdmap.begin(); c_it != cmdmap.end(); c_it++) {
-	if (!ficmp(line, c_it->first)) {
-	    cc = c_it->second;
-	    break;
-	}
-    }
-    return cc;
-}
+#include "repowork.h"
 
 int
-blob_parse_blob(git_blob_data *cd, std::ifstream &infile)
+blob_parse_blob(git_blob_data *cd, git_fi_reader &infile)
 {
     /* No other information on line - just consume it and continue */
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     return 0;
 }
 
 int
-blob_parse_data(git_blob_data *cd, std::ifstream &infile)
+blob_parse_data(git_blob_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 5);  // Remove "data " prefix
-    cd->length = std::stoi(line);
-    cd->offset = infile.tellg();
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 5);  // Remove "data " prefix
+    cd->length = fi_stol(line);
+    cd->offset = infile.tell();
+
+    // When streaming, the contents are left in the input for write_blob
+    // to pass along - that's all the parsing there is to do for this blob.
+    if (cd->s->stream_mode) {
+	return 1;
+    }
+
+    if (infile.copy_blobs || !infile.rewindable()) {
+	// We won't be able to get back to this data when it is time to write
+	// the blob, so hang on to a copy.
+	std::string_view bdata = infile.read(cd->length);
+	cd->length = bdata.length();
+	cd->cbuffer = new char [bdata.length()];
+	memcpy(cd->cbuffer, bdata.data(), bdata.length());
+	return 0;
+    }
 
 #if 0
     // Detect binary blobs (in case we ever want to try post-processing
     // of text blobs
-    int cc = 0;
-    char c;
-    bool bfile = false;
-    while (!infile.eof() && infile >> std::noskipws >> c && cc < 500) {
-	if (c == '\0') {
-	    bfile = true;
-	    break;
-	}
-	cc++;
-    }
-    if (bfile) {
+    std::string_view bdata = infile.view(cd->offset, 500);
+    if (bdata.find('\0') != std::string::npos) {
 	std::cout << "Binary blob\n";
     }
-    infile.clear();
 #endif
 
-    long offset = cd->offset + cd->length;
-    infile.seekg(offset);
+    infile.skip(cd->length);
     return 0;
 }
 
 int
-blob_parse_mark(git_blob_data *cd, std::ifstream &infile)
+blob_parse_mark(git_blob_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     //std::cout << "mark line: " << line << "\n";
-    line.erase(0, 5); // Remove "mark " prefix
+    line = fi_strip(line, 5); // Remove "mark " prefix
     //std::cout << "mark line: " << line << "\n";
-    if (line.c_str()[0] != ':') {
+    if (!line.length() || line[0] != ':') {
 	std::cerr << "Mark without \":\" character??: " <<  line << "\n";
 	return -1;
     }
-    line.erase(0, 1); // Remove ":" prefix
-    cd->id.mark = cd->s->next_mark(std::stol(line));
+    line = fi_strip(line, 1); // Remove ":" prefix
+    cd->id.mark = cd->s->next_mark(fi_stol(line));
     //std::cout << "Mark id :" << line << " -> " << cd->id.mark << "\n";
     return 0;
 }
 
 int
-blob_parse_original_oid(git_blob_data *cd, std::ifstream &infile)
+blob_parse_original_oid(git_blob_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 13);  // Remove "original-oid " prefix
-    cd->id.sha1 = line;
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 13);  // Remove "original-oid " prefix
+    cd->id.sha1 = git_oid(line);
     return 0;
 }
 
+static constexpr auto blob_cmds = fi_cmd_table_make<git_blob_data>({
+    {"blob", blob_parse_blob},
+    {"data", blob_parse_data},
+    {"mark", blob_parse_mark},
+    {"original-oid", blob_parse_original_oid}
+});
+
 int
-parse_blob(git_fi_data *fi_data, std::ifstream &infile)
+parse_blob(git_fi_data *fi_data, git_fi_reader &infile)
 {
     //std::cout << "Found command: blob\n";
 
     git_blob_data gbd;
     gbd.s = fi_data;
 
-    // Tell the blob where it will be in the vector.
-    gbd.id.index = fi_data->blobs.size();
+    fi_parse_record(&gbd, infile, blob_cmds);
 
-    std::map<std::string, blobcmd_t> cmdmap;
-    cmdmap[std::string("blob")] = blob_parse_blob;
-    cmdmap[std::string("data")] = blob_parse_data;
-    cmdmap[std::string("mark")] = blob_parse_mark;
-    cmdmap[std::string("original-oid")] = blob_parse_original_oid;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int blob_done = 0;
-    while (!blob_done && std::getline(infile, line)) {
-
-	blobcmd_t cc = blob_find_cmd(line, cmdmap);
-
-	// If we found a command, process it.  Otherwise, we are done
-	// with the blob and need to clean up.
-	if (cc) {
-	    //std::cout << "blob line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gbd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a blob input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    blob_done = 1;
-	}
+    if (fi_data->staging) {
+	fi_data->staged.push_back(std::make_pair(mark_blob, (long)fi_data->blobs.size()));
+	fi_data->blobs.push_back(gbd);
+	return 0;
     }
 
+    return add_blob(fi_data, gbd);
+}
+
+int
+add_blob(git_fi_data *fi_data, git_blob_data &gbd)
+{
+    // Tell the blob where it will be in the vector.
+    gbd.id.index = fi_data->blobs.size();
+
     gbd.id.mark = fi_data->next_mark(gbd.id.mark);
-    fi_data->mark_to_index[gbd.id.mark] = gbd.id.index;
+    fi_data->marks.set(gbd.id.mark, mark_blob, gbd.id.index);
 
     // If we have an original-oid sha1, associate it with the mark
-    if (gbd.id.sha1.length() == 40) {
-	fi_data->sha1_to_mark[gbd.id.sha1] = gbd.id.mark;
-	fi_data->mark_to_sha1[gbd.id.mark] = gbd.id.sha1;
+    if (!gbd.id.sha1.is_null()) {
+	fi_data->sha1_to_mark.insert(gbd.id.sha1, gbd.id.mark);
+	fi_data->mark_to_sha1.insert(gbd.id.mark, gbd.id.sha1);
     }
 
     // Add the blob to the data
@@ -154,27 +138,37 @@ parse_blob(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-write_blob(std::ofstream &outfile, git_blob_data *b, std::ifstream &infile)
+write_blob(git_fi_writer &outfile, git_blob_data *b, git_fi_reader &infile)
 {
-    if (!infile.good()) {
-        return -1;
+    // Contents - either a local copy, or still in the input.  Make sure
+    // the latter are actually there before starting on the header.
+    if (!b->cbuffer && !b->s->stream_mode && infile.mapped()) {
+	if (infile.view(b->offset, b->length).length() != b->length) {
+	    std::cerr << "Could not read blob " << b->id.mark << " from input\n";
+	    return -1;
+	}
     }
 
     // Header
     outfile << "blob\n";
     outfile << "mark :" << b->id.mark << "\n";
-    if (b->id.sha1.length()) {
+    if (!b->id.sha1.is_null()) {
 	outfile << "original-oid " << b->id.sha1 << "\n";
     } 
     outfile << "data " << b->length << "\n";
 
-    // Contents
-    /* TODO - probably don't really need to read this into memory... */
-    char *buffer = new char [b->length];
-    infile.seekg(b->offset);
-    infile.read(buffer, b->length);
-    outfile.write(buffer, b->length);
-    delete[] buffer;
+    // Blobs read from the input are passed through without copying them
+    // into memory (if the output allows, they don't leave the kernel.)
+    // Streamed blobs are next in the input - the others are found by offset.
+    if (b->cbuffer) {
+	outfile.write(b->cbuffer, b->length);
+    } else {
+	size_t copied = (b->s->stream_mode) ? infile.copy(outfile, b->length) : infile.copy_range(outfile, b->offset, b->length);
+	if (copied != b->length) {
+	    std::cerr << "Could not read blob " << b->id.mark << " from input\n";
+	    return -1;
+	}
+    }
     outfile << "\n";
     return 0;
 }
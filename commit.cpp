@@ -15,49 +15,35 @@
 #include "TextFlow.hpp"
 #include "repowork.h"
 
-typedef int (*commitcmd_t)(git_commit_data *, std::ifstream &);
-
-commitcmd_t
-commit_find_cmd(std::string &line, std::map<std::string, commitcmd_t> &cmdmap)
-{
-    commitcmd_t cc = NULL;
-    std::map<std::string, commitcmd_t>::iterator c_it;
-    for (c_it = cmdmap.begin(); c_it != cmdmap.end(); c_it++) {
-	if (!ficmp(line, c_it->first)) {
-	    cc = c_it->second;
-	    break;
-	}
-    }
-    return cc;
-}
-
 int
-commit_parse_author(git_commit_data *cd, std::ifstream &infile)
+commit_parse_author(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 7); // Remove "author " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 7); // Remove "author " prefix
     size_t spos = line.find_first_of(">");
     if (spos == std::string::npos) {
 	std::cerr << "Invalid author entry! " << line << "\n";
 	exit(EXIT_FAILURE);
     }
+    line = cd->s->store(line);
     cd->author = line.substr(0, spos+1);
     cd->author_timestamp = line.substr(spos+2, std::string::npos);
     return 0;
 }
 
 int
-commit_parse_committer(git_commit_data *cd, std::ifstream &infile)
+commit_parse_committer(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 10); // Remove "committer " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 10); // Remove "committer " prefix
     size_t spos = line.find_first_of(">");
     if (spos == std::string::npos) {
 	std::cerr << "Invalid committer entry! " << line << "\n";
 	exit(EXIT_FAILURE);
     }
+    line = cd->s->store(line);
     cd->committer = line.substr(0, spos+1);
     cd->committer_timestamp = line.substr(spos+2, std::string::npos);
     //std::cout << "Committer: " << cd->committer << "\n";
@@ -66,56 +52,52 @@ commit_parse_committer(git_commit_data *cd, std::ifstream &infile)
 }
 
 int
-commit_parse_commit(git_commit_data *cd, std::ifstream &infile)
+commit_parse_commit(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 7);  // Remove "commit " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 7);  // Remove "commit " prefix
     if (!ficmp(line, std::string("refs/notes/"))) {
 	// Notes commit - flag accordingly
 	cd->notes_commit = 1;
 	return 0;
     }
     size_t spos = line.find_last_of("/");
-    line.erase(0, spos+1); // Remove "refs/..." prefix
-    cd->branch = line;
+    line.remove_prefix(spos+1); // Remove "refs/..." prefix
+    cd->branch = cd->s->store(line);
     //std::cout << "Branch: " << cd->branch << "\n";
     return 0;
 }
 
 int
-commit_parse_data(git_commit_data *cd, std::ifstream &infile)
+commit_parse_data(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 5); // Remove "data " prefix
-    size_t data_len = std::stoi(line);
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 5); // Remove "data " prefix
+    size_t data_len = fi_stol(line);
     // This is the commit message - read it in
-    char *cbuffer = new char [data_len+1];
-    cbuffer[data_len] = '\0';
-    infile.read(cbuffer, data_len);
-    cd->commit_msg = std::string(cbuffer);
-    delete[] cbuffer;
+    cd->commit_msg = cd->s->store(infile.read(data_len));
     //std::cout << "Commit message:\n" << cd->commit_msg << "\n";
     return 0;
 }
 
 int
-commit_parse_encoding(git_commit_data *cd, std::ifstream &infile)
+commit_parse_encoding(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     std::cerr << "TODO - support encoding\n";
     exit(EXIT_FAILURE);
     return 0;
 }
 
 int
-commit_parse_from(git_commit_data *cd, std::ifstream &infile)
+commit_parse_from(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 5); // Remove "from " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 5); // Remove "from " prefix
     //std::cout << "from line: " << line << "\n";
     int ret = git_parse_commitish(cd->from, cd->s, line);
     if (!ret) {
@@ -126,29 +108,29 @@ commit_parse_from(git_commit_data *cd, std::ifstream &infile)
 }
 
 int
-commit_parse_mark(git_commit_data *cd, std::ifstream &infile)
+commit_parse_mark(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     //std::cout << "mark line: " << line << "\n";
-    line.erase(0, 5); // Remove "mark " prefix
+    line = fi_strip(line, 5); // Remove "mark " prefix
     //std::cout << "mark line: " << line << "\n";
-    if (line.c_str()[0] != ':') {
+    if (!line.length() || line[0] != ':') {
 	std::cerr << "Mark without \":\" character??: " <<  line << "\n";
 	return -1;
     }
-    line.erase(0, 1); // Remove ":" prefix
-    cd->id.mark = cd->s->next_mark(std::stol(line));
+    line = fi_strip(line, 1); // Remove ":" prefix
+    cd->id.mark = cd->s->next_mark(fi_stol(line));
     //std::cout << "Mark id :" << line << " -> " << cd->id.mark << "\n";
     return 0;
 }
 
 int
-commit_parse_merge(git_commit_data *cd, std::ifstream &infile)
+commit_parse_merge(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 6); // Remove "merge " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 6); // Remove "merge " prefix
     //std::cout << "merge line: " << line << "\n";
     git_commitish merge_id;
     int ret = git_parse_commitish(merge_id, cd->s, line);
@@ -162,25 +144,25 @@ commit_parse_merge(git_commit_data *cd, std::ifstream &infile)
 }
 
 int
-commit_parse_original_oid(git_commit_data *cd, std::ifstream &infile)
+commit_parse_original_oid(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 13);  // Remove "original-oid " prefix
-    cd->id.sha1 = line;
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 13);  // Remove "original-oid " prefix
+    cd->id.sha1 = git_oid(line);
     cd->s->have_sha1s = true;
-    if (cd->s->sha12key.find(cd->id.sha1) != cd->s->sha12key.end()) {
+    if (!cd->s->staging && !cd->id.sha1.is_null() && cd->s->sha12key.find(cd->id.sha1)) {
 	std::cout << "Have CVS info for commit " << cd->id.sha1 << "\n";
     }
     return 0;
 }
 
 int
-commit_parse_filecopy(git_commit_data *cd, std::ifstream &infile)
+commit_parse_filecopy(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 2); // Remove "C " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 2); // Remove "C " prefix
     size_t spos = line.find_first_of(" ");
     if (spos == std::string::npos) {
     	std::cerr << "Invalid copy specifier: " << line << "\n";
@@ -193,52 +175,97 @@ commit_parse_filecopy(git_commit_data *cd, std::ifstream &infile)
     }
     git_op op;
     op.type = filecopy;
-    op.path = line.substr(0, spos);
-    op.dest_path = line.substr(spos+1, std::string::npos);
+    op.path = cd->s->paths.intern(line.substr(0, spos));
+    op.dest_path = cd->s->paths.intern(line.substr(spos+1, std::string::npos));
     //std::cout << "filecopy: " << op.path << " -> " << op.dest_path << "\n";
     cd->fileops.push_back(op);
     return 0;
 }
 
 int
-commit_parse_filedelete(git_commit_data *cd, std::ifstream &infile)
+commit_parse_filedelete(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 2); // Remove "D " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 2); // Remove "D " prefix
     git_op op;
     op.type = filedelete;
-    op.path = line;
+    op.path = cd->s->paths.intern(line);
     cd->fileops.push_back(op);
     //std::cout << "filedelete: " << line << "\n";
     return 0;
 }
 
+static inline bool
+fmod_digit(char c)
+{
+    return (c >= '0' && c <= '9');
+}
+
+static inline bool
+fmod_dataref(char c)
+{
+    return (c == ':' || fmod_digit(c) || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+}
+
+// Split the contents of a filemodify line into mode, dataref and path.  This
+// finds the same fields a search for "([0-9]+) ([:A-Za-z0-9]+) (.*)" would
+// (including the regex '.' stopping at a carriage return) without needing to
+// build and run a std::regex for every line.
+static bool
+filemodify_fields(std::string_view line, std::string_view &mode, std::string_view &dataref, std::string_view &path)
+{
+    size_t len = line.length();
+    for (size_t start = 0; start < len; start++) {
+	size_t i = start;
+	while (i < len && fmod_digit(line[i]))
+	    i++;
+	if (i == start || i == len || line[i] != ' ')
+	    continue;
+	mode = line.substr(start, i - start);
+	size_t dstart = ++i;
+	while (i < len && fmod_dataref(line[i]))
+	    i++;
+	if (i == dstart || i == len || line[i] != ' ')
+	    continue;
+	dataref = line.substr(dstart, i - dstart);
+	path = line.substr(i + 1);
+	path = path.substr(0, path.find('\r'));
+	return true;
+    }
+    return false;
+}
+
 int
-commit_parse_filemodify(git_commit_data *cd, std::ifstream &infile)
-{
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 2); // Remove "M " prefix
-    std::regex fmod("([0-9]+) ([:A-Za-z0-9]+) (.*)");
-    std::smatch fmodvar;
-    if (!std::regex_search(line, fmodvar, fmod)) {
+commit_parse_filemodify(git_commit_data *cd, git_fi_reader &infile)
+{
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 2); // Remove "M " prefix
+    std::string_view mode, dataref, path;
+    if (!filemodify_fields(line, mode, dataref, path)) {
 	std::cerr << "Invalid modification specifier: " << line << "\n";
 	return -1;
     }
     git_op op;
     op.type = filemodify;
-    op.mode = std::string(fmodvar[1]);
-    std::string dataref = std::string(fmodvar[2]);
-    if (dataref == std::string("inline")) {
+    op.mode = git_mode_parse(mode);
+    if (op.mode == mode_none) {
+	std::cerr << "Unsupported file mode: " << mode << "\n";
+	exit(EXIT_FAILURE);
+    }
+    if (dataref == "inline") {
 	std::cerr << "inline data unsupported\n";
 	exit(EXIT_FAILURE);
     }
-    int ret = git_parse_commitish(op.dataref, cd->s, dataref);
-    if (ret || (op.dataref.mark == -1 && !op.dataref.sha1.length())) {
+    git_commitish dref;
+    int ret = git_parse_commitish(dref, cd->s, dataref);
+    if (ret || (dref.mark == -1 && dref.sha1.is_null())) {
 	std::cerr << "Invalid data ref!: " << dataref << "\n";
     }
-    op.path = std::string(fmodvar[3]);
+    op.dataref.mark = dref.mark;
+    op.dataref.sha1 = dref.sha1;
+    op.path = cd->s->paths.intern(path);
 
     //std::cout << "filemodify: " << op.mode << "," << op.dataref.index << "," << op.path << "\n";
 
@@ -248,20 +275,20 @@ commit_parse_filemodify(git_commit_data *cd, std::ifstream &infile)
 }
 
 int
-commit_parse_notemodify(git_commit_data *cd, std::ifstream &infile)
+commit_parse_notemodify(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     std::cerr << "notemodify currently unsupported:" << line << "\n";
     exit(EXIT_FAILURE);
 }
 
 int
-commit_parse_filerename(git_commit_data *cd, std::ifstream &infile)
+commit_parse_filerename(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 2); // Remove "R " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 2); // Remove "R " prefix
     size_t spos = line.find_first_of(" ");
     if (spos == std::string::npos) {
     	std::cerr << "Invalid copy specifier: " << line << "\n";
@@ -274,18 +301,18 @@ commit_parse_filerename(git_commit_data *cd, std::ifstream &infile)
     }
     git_op op;
     op.type = filerename;
-    op.path = line.substr(0, spos);
-    op.dest_path = line.substr(spos+1, std::string::npos);
+    op.path = cd->s->paths.intern(line.substr(0, spos));
+    op.dest_path = cd->s->paths.intern(line.substr(spos+1, std::string::npos));
     //std::cout << "filerename: " << op.path << " -> " << op.dest_path << "\n"; 
     cd->fileops.push_back(op);
     return 0;
 }
 
 int
-commit_parse_deleteall(git_commit_data *cd, std::ifstream &infile)
+commit_parse_deleteall(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
     if (line != std::string("deleteall")) {
     	std::cerr << "warning - invalid deleteall specifier:" << line << "\n";
     }
@@ -295,324 +322,302 @@ commit_parse_deleteall(git_commit_data *cd, std::ifstream &infile)
     return 0;
 }
 
+static constexpr auto commit_cmds = fi_cmd_table_make<git_commit_data>({
+    // Commit info modification commands
+    {"author", commit_parse_author},
+    {"commit ", commit_parse_commit}, // Note - need space after commit to avoid matching committer!
+    {"committer", commit_parse_committer},
+    {"data", commit_parse_data},
+    {"encoding", commit_parse_encoding},
+    {"from", commit_parse_from},
+    {"mark", commit_parse_mark},
+    {"merge", commit_parse_merge},
+    {"original-oid", commit_parse_original_oid},
+
+    // tree modification commands
+    {"C ", commit_parse_filecopy},
+    {"D ", commit_parse_filedelete},
+    {"M ", commit_parse_filemodify},
+    {"N ", commit_parse_notemodify},
+    {"R ", commit_parse_filerename},
+    {"deleteall", commit_parse_deleteall}
+});
+
+template <fi_parse_mode M>
 int
-parse_commit(git_fi_data *fi_data, std::ifstream &infile)
+parse_commit(git_fi_data *fi_data, git_fi_reader &infile)
 {
     //std::cout << "Found command: commit\n";
 
     git_commit_data gcd;
     gcd.s = fi_data;
 
-    // Tell the commit where it will be in the vector - this
-    // uniquely identifies this specific commit, regardless of
-    // its sha1.
-    gcd.id.index = fi_data->commits.size();
+    fi_parse_record(&gcd, infile, commit_cmds);
 
-    std::map<std::string, commitcmd_t> cmdmap;
-    // Commit info modification commands
-    cmdmap[std::string("author")] = commit_parse_author;
-    cmdmap[std::string("commit ")] = commit_parse_commit; // Note - need space after commit to avoid matching committer!
-    cmdmap[std::string("committer")] = commit_parse_committer;
-    cmdmap[std::string("data")] = commit_parse_data;
-    cmdmap[std::string("encoding")] = commit_parse_encoding;
-    cmdmap[std::string("from")] = commit_parse_from;
-    cmdmap[std::string("mark")] = commit_parse_mark;
-    cmdmap[std::string("merge")] = commit_parse_merge;
-    cmdmap[std::string("original-oid")] = commit_parse_original_oid;
-
-    // tree modification commands
-    cmdmap[std::string("C ")] = commit_parse_filecopy;
-    cmdmap[std::string("D ")] = commit_parse_filedelete;
-    cmdmap[std::string("M ")] = commit_parse_filemodify;
-    cmdmap[std::string("N ")] = commit_parse_notemodify;
-    cmdmap[std::string("R ")] = commit_parse_filerename;
-    cmdmap[std::string("deleteall")] = commit_parse_deleteall;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int commit_done = 0;
-    while (!commit_done && std::getline(infile, line)) {
-
-	commitcmd_t cc = commit_find_cmd(line, cmdmap);
-
-	// If we found a command, process it.  Otherwise, we are done
-	// with the commit and need to clean up.
-	if (cc) {
-	    //std::cout << "commit line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gcd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a commit input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    commit_done = 1;
-	}
+    if (fi_data->staging) {
+	fi_data->staged.push_back(std::make_pair(mark_commit, (long)fi_data->commits.size()));
+	fi_data->commits.push_back(std::move(gcd));
+	return 0;
     }
 
-    gcd.id.mark = fi_data->next_mark(gcd.id.mark);
-    fi_data->mark_to_index[gcd.id.mark] = gcd.id.index;
+    return add_commit<M>(fi_data, gcd);
+}
 
-    // If we have a sha1 and this is not a notes commit, we need to map it to
-    // this commit's mark
-    if (!gcd.notes_commit && gcd.id.sha1.length()) {
-	fi_data->sha1_to_mark[gcd.id.sha1] = gcd.id.mark;
+// Replacement commits overwrite the parts of the existing commit they
+// specify - anything not present in the replacement is left alone.  File
+// operations and merges are added to the existing ones.
+static int
+replace_commit(git_fi_data *fi_data, git_commit_data &rcd)
+{
+    // First, find the existing commit for this sha1.  If we don't
+    // have that, we're out of business.
+    long *rmark = fi_data->sha1_to_mark.find(git_oid(fi_data->replace_sha1));
+    if (!rmark) {
+	std::cerr << "Trying to process unknown replacement sha1 " << fi_data->replace_sha1 << "\n";
+	return -1;
     }
+    long index = fi_data->marks.index(*rmark);
+    git_commit_data &gcd = fi_data->commits[index];
 
-    //std::cout << "commit new mark: " << gcd.id.mark << "\n";
-
-    // Add the commit to the data
-    fi_data->commits.push_back(gcd);
-
+    if (rcd.notes_commit)
+	gcd.notes_commit = rcd.notes_commit;
+    if (rcd.branch.data())
+	gcd.branch = rcd.branch;
+    if (rcd.author.data()) {
+	gcd.author = rcd.author;
+	gcd.author_timestamp = rcd.author_timestamp;
+    }
+    if (rcd.committer.data()) {
+	gcd.committer = rcd.committer;
+	gcd.committer_timestamp = rcd.committer_timestamp;
+    }
+    if (rcd.commit_msg.data())
+	gcd.commit_msg = rcd.commit_msg;
+    if (rcd.from.mark != -1 || !rcd.from.sha1.is_null())
+	gcd.from = rcd.from;
+    if (rcd.id.mark != -1)
+	gcd.id.mark = fi_data->next_mark(rcd.id.mark);
+    if (!rcd.id.sha1.is_null())
+	gcd.id.sha1 = rcd.id.sha1;
+    gcd.merges.insert(gcd.merges.end(), rcd.merges.begin(), rcd.merges.end());
+    gcd.fileops.insert(gcd.fileops.end(), rcd.fileops.begin(), rcd.fileops.end());
+
+    fi_data->children.add(gcd.id.index, gcd.from, gcd.merges);
     return 0;
 }
 
+template <fi_parse_mode M>
 int
-parse_splice_commit(git_fi_data *fi_data, std::ifstream &infile)
+add_commit(git_fi_data *fi_data, git_commit_data &gcd)
 {
-    //std::cout << "Found command: commit\n";
-
-    git_commit_data gcd;
-    gcd.s = fi_data;
+    if constexpr (M == fi_parse_replace) {
+	return replace_commit(fi_data, gcd);
+    }
 
     // Tell the commit where it will be in the vector - this
     // uniquely identifies this specific commit, regardless of
     // its sha1.
-    gcd.id.index = fi_data->commits.size() + fi_data->splice_commits.size();
-
-    std::map<std::string, commitcmd_t> cmdmap;
-    // Commit info modification commands
-    cmdmap[std::string("author")] = commit_parse_author;
-    cmdmap[std::string("commit ")] = commit_parse_commit; // Note - need space after commit to avoid matching committer!
-    cmdmap[std::string("committer")] = commit_parse_committer;
-    cmdmap[std::string("data")] = commit_parse_data;
-    cmdmap[std::string("encoding")] = commit_parse_encoding;
-    cmdmap[std::string("from")] = commit_parse_from;
-    cmdmap[std::string("mark")] = commit_parse_mark;
-    cmdmap[std::string("merge")] = commit_parse_merge;
-    cmdmap[std::string("original-oid")] = commit_parse_original_oid;
-
-    // tree modification commands
-    cmdmap[std::string("C ")] = commit_parse_filecopy;
-    cmdmap[std::string("D ")] = commit_parse_filedelete;
-    cmdmap[std::string("M ")] = commit_parse_filemodify;
-    cmdmap[std::string("N ")] = commit_parse_notemodify;
-    cmdmap[std::string("R ")] = commit_parse_filerename;
-    cmdmap[std::string("deleteall")] = commit_parse_deleteall;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int commit_done = 0;
-    while (!commit_done && std::getline(infile, line)) {
-
-	commitcmd_t cc = commit_find_cmd(line, cmdmap);
-
-	// If we found a command, process it.  Otherwise, we are done
-	// with the commit and need to clean up.
-	if (cc) {
-	    //std::cout << "commit line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gcd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a commit input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    commit_done = 1;
-	}
+    if constexpr (M == fi_parse_splice) {
+	gcd.id.index = fi_data->commits.size() + fi_data->splice_commits.size();
+    } else {
+	gcd.id.index = fi_data->commits.size();
     }
 
     gcd.id.mark = fi_data->next_mark(gcd.id.mark);
-    fi_data->mark_to_index[gcd.id.mark] = gcd.id.index;
+    fi_data->marks.set(gcd.id.mark, mark_commit, gcd.id.index);
 
     //std::cout << "commit new mark: " << gcd.id.mark << "\n";
 
-    // Add the commit to the data
-    fi_data->splice_commits.push_back(gcd);
-
-    // Mark the original commit as having a splice, so we will
-    // be able to write this out in the correct order for the
-    // fi file.
-    if (gcd.from.index < (long)fi_data->commits.size()) {
-	git_commit_data &oc = fi_data->commits[gcd.from.index];
-	fi_data->splice_map[oc.id.mark] = gcd.id.mark;
-    } else {
-	std::cerr << "TODO: Multi-commit splices\n";
-	exit(1);
+    // If we have a sha1 and this is not a notes commit, we need to map it to
+    // this commit's mark.  (Splices and added commits too - later ones may
+    // name them as their parents.)
+    if (!gcd.notes_commit && !gcd.id.sha1.is_null()) {
+	fi_data->sha1_to_mark.insert(gcd.id.sha1, gcd.id.mark);
     }
 
-    // For any commits that listed oc as their from commit, they
-    // now need to be updated to reference the new one instead.
-    for (size_t i = 0; i < fi_data->commits.size(); i++) {
-	git_commit_data &c = fi_data->commits[i];
-	if (c.from.index == gcd.from.index) {
-	    std::cout << "Updating from id of " << c.id.sha1 << "\n";
-	    c.from = gcd.id;
+    if constexpr (M != fi_parse_splice) {
+	// Add the commit to the data
+	if (!fi_data->stream_mode) {
+	    fi_data->children.add(gcd.id.index, gcd.from, gcd.merges);
 	}
+	fi_data->commits.push_back(std::move(gcd));
+	return 0;
     }
 
+    // Splices are stored separately from the main commits, and linked
+    // into the history by git_link_splices once they are all in.
+    fi_data->splice_commits.push_back(std::move(gcd));
     return 0;
 }
 
-int
-parse_replace_commit(git_fi_data *fi_data, std::ifstream &infile)
+// Parent of a splice commit.  Parents given by SHA1 may be splices from
+// files merged after the splice's own, so they are looked up again now that
+// everything is known.
+static long
+splice_parent(git_fi_data *fi_data, git_commit_data *scd)
 {
-    // First, find the existing commit for this sha1.  If we don't
-    // have that, we're out of business.
-    if (fi_data->sha1_to_mark.find(fi_data->replace_sha1) == fi_data->sha1_to_mark.end()) {
-	std::cerr << "Trying to process unknown replacement sha1 " << fi_data->replace_sha1 << "\n";
-	return -1;
+    if (scd->from.index < 0 && !scd->from.sha1.is_null()) {
+	git_resolve_commitish(scd->from, fi_data);
     }
-    int index = fi_data->mark_to_index[fi_data->sha1_to_mark[fi_data->replace_sha1]];
-    git_commit_data &gcd = fi_data->commits[index];
+    for (size_t i = 0; i < scd->merges.size(); i++) {
+	if (scd->merges[i].index < 0 && !scd->merges[i].sha1.is_null()) {
+	    git_resolve_commitish(scd->merges[i], fi_data);
+	}
+    }
+    long pind = scd->from.index;
+    if (pind < 0 || !fi_data->commit_at(pind)) {
+	std::cerr << "Could not find the parent of splice commit " << scd->id.mark << "\n";
+	exit(1);
+    }
+    return pind;
+}
 
-    std::map<std::string, commitcmd_t> cmdmap;
-    // Commit info modification commands
-    cmdmap[std::string("author")] = commit_parse_author;
-    cmdmap[std::string("commit ")] = commit_parse_commit; // Note - need space after commit to avoid matching committer!
-    cmdmap[std::string("committer")] = commit_parse_committer;
-    cmdmap[std::string("data")] = commit_parse_data;
-    cmdmap[std::string("encoding")] = commit_parse_encoding;
-    cmdmap[std::string("from")] = commit_parse_from;
-    cmdmap[std::string("mark")] = commit_parse_mark;
-    cmdmap[std::string("merge")] = commit_parse_merge;
-    cmdmap[std::string("original-oid")] = commit_parse_original_oid;
+// Link a splice into the chain of commits following its parent, so we will
+// be able to write it out in the correct order for the fi file.
+static void
+link_splice(git_fi_data *fi_data, git_commit_data *scd)
+{
+    long pind = scd->from.index;
+    fi_data->children.link(scd->id.index, scd->from, scd->merges);
+    if (fi_data->splice_next.size() < (size_t)scd->id.index + 1) {
+	fi_data->splice_next.resize(scd->id.index + 1, -1);
+    }
+    fi_data->splice_next[scd->id.index] = fi_data->splice_after(pind);
+    fi_data->splice_next[pind] = scd->id.index;
 
-    // tree modification commands
-    cmdmap[std::string("C ")] = commit_parse_filecopy;
-    cmdmap[std::string("D ")] = commit_parse_filedelete;
-    cmdmap[std::string("M ")] = commit_parse_filemodify;
-    cmdmap[std::string("N ")] = commit_parse_notemodify;
-    cmdmap[std::string("R ")] = commit_parse_filerename;
-    cmdmap[std::string("deleteall")] = commit_parse_deleteall;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int commit_done = 0;
-    while (!commit_done && std::getline(infile, line)) {
-
-	commitcmd_t cc = commit_find_cmd(line, cmdmap);
-
-	// If we found a command, process it.  Otherwise, we are done
-	// with the commit and need to clean up.
-	if (cc) {
-	    //std::cout << "commit line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gcd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a commit input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    commit_done = 1;
+    // For any commits that listed the parent as their from commit, they
+    // now need to be updated to reference the new one instead.
+    for (long ci : fi_data->children.of(pind)) {
+	git_commit_data *c = fi_data->commit_at(ci);
+	if (!c || ci == scd->id.index)
+	    continue;
+	if (c->from.index == pind) {
+	    std::cout << "Updating from id of " << c->id.sha1 << "\n";
+	    c->from = scd->id;
+	    fi_data->children.link(scd->id.index, ci);
 	}
     }
-
-    return 0;
 }
 
+// The parent of a splice may itself be a splice, so chains can be any
+// length.  Splices are linked in the order they were merged, except that a
+// splice whose parent is a splice not linked yet waits for its parent.
 int
-parse_add_commit(git_fi_data *fi_data, std::ifstream &infile)
+git_link_splices(git_fi_data *fi_data)
 {
-    //std::cout << "Found command: commit\n";
-
-    git_commit_data gcd;
-    gcd.s = fi_data;
-
-    // Tell the commit where it will be in the vector - this
-    // uniquely identifies this specific commit, regardless of
-    // its sha1.
-    gcd.id.index = fi_data->commits.size();
-
-    std::map<std::string, commitcmd_t> cmdmap;
-    // Commit info modification commands
-    cmdmap[std::string("author")] = commit_parse_author;
-    cmdmap[std::string("commit ")] = commit_parse_commit; // Note - need space after commit to avoid matching committer!
-    cmdmap[std::string("committer")] = commit_parse_committer;
-    cmdmap[std::string("data")] = commit_parse_data;
-    cmdmap[std::string("encoding")] = commit_parse_encoding;
-    cmdmap[std::string("from")] = commit_parse_from;
-    cmdmap[std::string("mark")] = commit_parse_mark;
-    cmdmap[std::string("merge")] = commit_parse_merge;
-    cmdmap[std::string("original-oid")] = commit_parse_original_oid;
-
-    // tree modification commands
-    cmdmap[std::string("C ")] = commit_parse_filecopy;
-    cmdmap[std::string("D ")] = commit_parse_filedelete;
-    cmdmap[std::string("M ")] = commit_parse_filemodify;
-    cmdmap[std::string("N ")] = commit_parse_notemodify;
-    cmdmap[std::string("R ")] = commit_parse_filerename;
-    cmdmap[std::string("deleteall")] = commit_parse_deleteall;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int commit_done = 0;
-    while (!commit_done && std::getline(infile, line)) {
-
-	commitcmd_t cc = commit_find_cmd(line, cmdmap);
-
-	// If we found a command, process it.  Otherwise, we are done
-	// with the commit and need to clean up.
-	if (cc) {
-	    //std::cout << "commit line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gcd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a commit input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    commit_done = 1;
+    long nmain = (long)fi_data->commits.size();
+    std::vector<char> state(fi_data->splice_commits.size(), 0); // 1 - waiting, 2 - linked
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < fi_data->splice_commits.size(); i++) {
+	pending.push_back(i);
+	while (pending.size()) {
+	    size_t s = pending.back();
+	    git_commit_data *scd = &fi_data->splice_commits[s];
+	    if (state[s] == 2) {
+		pending.pop_back();
+		continue;
+	    }
+	    if (!state[s]) {
+		state[s] = 1;
+		long pind = splice_parent(fi_data, scd);
+		if (pind >= nmain && state[pind - nmain] != 2) {
+		    if (state[pind - nmain] == 1) {
+			std::cerr << "Splice commit " << scd->id.mark << " is its own ancestor\n";
+			exit(1);
+		    }
+		    pending.push_back(pind - nmain);
+		    continue;
+		}
+	    }
+	    link_splice(fi_data, scd);
+	    state[s] = 2;
+	    pending.pop_back();
 	}
     }
-
-    gcd.id.mark = fi_data->next_mark(gcd.id.mark);
-    fi_data->mark_to_index[gcd.id.mark] = gcd.id.index;
-
-    //std::cout << "commit new mark: " << gcd.id.mark << "\n";
-
-    // Add the commit to the data
-    fi_data->commits.push_back(gcd);
-
     return 0;
 }
 
+template int parse_commit<fi_parse_normal>(git_fi_data *fi_data, git_fi_reader &infile);
+template int parse_commit<fi_parse_splice>(git_fi_data *fi_data, git_fi_reader &infile);
+template int parse_commit<fi_parse_replace>(git_fi_data *fi_data, git_fi_reader &infile);
+template int parse_commit<fi_parse_add>(git_fi_data *fi_data, git_fi_reader &infile);
+template int add_commit<fi_parse_normal>(git_fi_data *fi_data, git_commit_data &gcd);
+template int add_commit<fi_parse_splice>(git_fi_data *fi_data, git_commit_data &gcd);
+template int add_commit<fi_parse_replace>(git_fi_data *fi_data, git_commit_data &gcd);
+template int add_commit<fi_parse_add>(git_fi_data *fi_data, git_commit_data &gcd);
+
+// Records in a staging git_fi_data (see git_fi_data::staging) refer to
+// marks, SHA1s and paths as they were in the input.  Translate them for the
+// data the commit is being merged into (c->s).  pmap holds the path ids
+// already translated (indexed by staged path id, 0 if not yet known) -
+// paths are added to c->s in the order they are first used, just as they
+// would have been if the input was parsed straight into c->s.
+void
+commit_resolve_staged(git_commit_data *c, git_fi_data *st, std::vector<uint32_t> &pmap)
+{
+    git_fi_data *s = c->s;
+    git_resolve_commitish(c->from, s);
+    for (size_t i = 0; i < c->merges.size(); i++) {
+	git_resolve_commitish(c->merges[i], s);
+    }
+    for (size_t i = 0; i < c->fileops.size(); i++) {
+	git_op &op = c->fileops[i];
+	if (op.type == filemodify) {
+	    git_commitish dref;
+	    dref.mark = op.dataref.mark;
+	    dref.sha1 = op.dataref.sha1;
+	    git_resolve_commitish(dref, s);
+	    op.dataref.mark = dref.mark;
+	}
+	if (pmap.size() < st->paths.size()) {
+	    pmap.resize(st->paths.size(), 0);
+	}
+	if (op.path && !pmap[op.path]) {
+	    pmap[op.path] = s->paths.intern(st->paths.str(op.path));
+	}
+	op.path = pmap[op.path];
+	if (op.dest_path && !pmap[op.dest_path]) {
+	    pmap[op.dest_path] = s->paths.intern(st->paths.str(op.dest_path));
+	}
+	op.dest_path = pmap[op.dest_path];
+    }
+    if (!c->id.sha1.is_null() && s->sha12key.find(c->id.sha1)) {
+	std::cout << "Have CVS info for commit " << c->id.sha1 << "\n";
+    }
+}
+
 
 void
-write_op(std::ofstream &outfile, git_op *o, git_fi_data *s)
+write_op(git_fi_writer &outfile, git_op *o, git_fi_data *s)
 {
-    bool written = false;
+    // Ops only hold ids - the text is rendered straight from the tables
+    const git_path_table &p = s->paths;
     switch (o->type) {
 	case filemodify:
-	    if (o->dataref.sha1.length()) {
-		outfile << "M " << o->mode << " " << o->dataref.sha1 << " " << o->path << "\n";
-		written = true;
-	    }
-	    if (!written && o->dataref.mark > -1 && s->mark_to_sha1.find(o->dataref.mark) != s->mark_to_sha1.end()) {
-		outfile << "M " << o->mode << " " << s->mark_to_sha1[o->dataref.mark] << " " << o->path << "\n";
-		written = true;
-	    }
-	    if (!written && o->dataref.mark > -1) {
-		outfile << "M " << o->mode << " :" << o->dataref.mark << " " << o->path << "\n";
-		written = true;
-	    }
-	    if (!written) {
+	    outfile << "M " << git_mode_str(o->mode) << " ";
+	    if (!o->dataref.sha1.is_null()) {
+		outfile << o->dataref.sha1;
+	    } else if (o->dataref.mark > -1) {
+		const git_oid *oid = s->mark_to_sha1.find(o->dataref.mark);
+		if (oid) {
+		    outfile << *oid;
+		} else {
+		    outfile << ":" << o->dataref.mark;
+		}
+	    } else {
 		std::cerr << "Invalid filemodify dataref: " << o->dataref.mark << "," << o->dataref.sha1 << "\n";
 		exit(1);
 	    }
+	    outfile << " " << p.str(o->path) << "\n";
 	    break;
 	case filedelete:
-	    outfile << "D " << o->path << "\n";
+	    outfile << "D " << p.str(o->path) << "\n";
 	    break;
 	case filecopy:
-	    outfile << "C " << o->path << " " << o->dest_path << "\n";
+	    outfile << "C " << p.str(o->path) << " " << p.str(o->dest_path) << "\n";
 	    break;
 	case filerename:
-	    outfile << "R " << o->path << " " << o->dest_path << "\n";
+	    outfile << "R " << p.str(o->path) << " " << p.str(o->dest_path) << "\n";
 	    break;
 	case filedeleteall:
 	    outfile << "deleteall\n";
@@ -630,32 +635,52 @@ static inline void rtrim(std::string &s) {
     }).base(), s.end());
 }
 
-std::string
-commit_msg(git_commit_data *c)
+// Views don't need any copying to trim - just shorten them
+static inline void rtrim(std::string_view &s) {
+    s = s.substr(0, std::find_if(s.rbegin(), s.rend(), [](int ch) {
+        return !(std::isspace(ch) || ch == '\n' || ch == '\r');
+    }).base() - s.begin());
+}
+
+// Work out the commit message as it is to be written.  This leaves c as it
+// is - so messages can be rendered on several threads at once - and anything
+// new is stored in arena.  If the CVS author information replaced an
+// svn:account line, replaced_account is set.
+std::string_view
+commit_msg(git_commit_data *c, fi_arena &arena, bool &replaced_account)
 {
     int cwidth = c->s->wrap_width;
+    std::string_view msg = c->commit_msg;
     std::string nmsg;
 
     // Any whitespace at the end of the message, just trim it
     if (c->s->trim_whitespace) {
-	rtrim(c->commit_msg);
+	rtrim(msg);
+    }
+
+    // Check for CVS information to add
+    const std::string *ckey = (c->id.sha1.is_null()) ? NULL : c->s->sha12key.find(c->id.sha1);
+
+    // If nothing is being done to it, the message goes out as it is
+    if (!c->s->trim_whitespace && !c->s->wrap_commit_lines && !c->notes_string.length() && !ckey) {
+	return msg;
     }
 
     if (c->s->wrap_commit_lines) {
 	// Wrap the commit messages - gitk doesn't like long one liners by
 	// default.  Don't know why the line wrap ISN'T on by default, but we
 	// might as well deal with it while we're here...
-	size_t pdelim = c->commit_msg.find("\n\n");
+	size_t pdelim = msg.find("\n\n");
 	if (pdelim == std::string::npos) {
-	    size_t spos = c->commit_msg.find_first_of('\n');
+	    size_t spos = msg.find_first_of('\n');
 	    if (spos == std::string::npos) {
-		std::string wmsg = TextFlow::Column(c->commit_msg).width(cwidth).toString();
-		c->commit_msg = wmsg;
+		std::string wmsg = TextFlow::Column(std::string(msg)).width(cwidth).toString();
+		msg = arena.store(wmsg);
 	    }
 	} else {
 	    // Multiple paragraphs - separate them for individual consideration.
 	    std::vector<std::string> paragraphs;
-	    std::string paragraphs_str = c->commit_msg;
+	    std::string paragraphs_str(msg);
 	    while (paragraphs_str.length()) {
 		std::string para = paragraphs_str.substr(0, pdelim);
 		std::string remainder = paragraphs_str.substr(pdelim+2, std::string::npos);
@@ -691,13 +716,13 @@ commit_msg(git_commit_data *c)
 		    newcommitmsg.append("\n\n");
 		}
 		rtrim(newcommitmsg);
-		c->commit_msg = newcommitmsg;
+		msg = arena.store(newcommitmsg);
 	    }
 	}
     }
 
     if (c->notes_string.length()) {
-	std::string nstr = c->notes_string;
+	std::string nstr(c->notes_string);
 	if (c->s->trim_whitespace) rtrim(nstr);
 	if (c->s->wrap_commit_lines) {
 	    size_t spos = nstr.find_first_of('\n');
@@ -706,32 +731,34 @@ commit_msg(git_commit_data *c)
 		nstr = wmsg;
 	    }
 	}
+	nmsg.append(msg);
+	nmsg.append("\n\n");
+	nmsg.append(nstr);
+	nmsg.append("\n");
 	if (c->svn_committer.length()) {
-	    std::string committerstr = std::string("svn:account:") + c->svn_committer;
-	    nmsg = c->commit_msg + std::string("\n\n") + nstr + std::string("\n") + committerstr + std::string("\n");
-	} else {
-	    nmsg = c->commit_msg + std::string("\n\n") + nstr + std::string("\n");
+	    nmsg.append("svn:account:");
+	    nmsg.append(c->svn_committer);
+	    nmsg.append("\n");
 	}
     } else {
+	nmsg = msg;
 	if (c->s->trim_whitespace) {
-	    nmsg = c->commit_msg + std::string("\n");
-	} else {
-	    nmsg = c->commit_msg;
+	    nmsg.append("\n");
 	}
     }
 
-    // Check for CVS information to add
-    if (c->s->sha12key.find(c->id.sha1) != c->s->sha12key.end()) {
+    if (ckey) {
 	std::string cvsmsg = nmsg;
-	std::string key = c->s->sha12key[c->id.sha1];
+	std::string key = *ckey;
 	int have_ret = (c->svn_id.length()) ? 1 : 0;
-	if (c->s->key2cvsbranch.find(key) != c->s->key2cvsbranch.end()) {
-	    //std::cout << "Found branch: " << c->s->key2cvsbranch[key] << "\n";
+	std::map<std::string, std::string>::const_iterator cb_it = c->s->key2cvsbranch.find(key);
+	if (cb_it != c->s->key2cvsbranch.end()) {
+	    //std::cout << "Found branch: " << cb_it->second << "\n";
 	    if (!have_ret) {
 		cvsmsg.append("\n");
 		have_ret = 1;
 	    }
-	    std::string cb = c->s->key2cvsbranch[key];
+	    const std::string &cb = cb_it->second;
 	    cvsmsg.append("cvs:branch:");
 	    if (cb == std::string("master")) {
 		cvsmsg.append("trunk");
@@ -740,16 +767,17 @@ commit_msg(git_commit_data *c)
 	    }
 	    cvsmsg.append("\n");
 	}
-	if (c->s->key2cvsauthor.find(key) != c->s->key2cvsauthor.end()) {
-	    //std::cout << "Found author: " << c->s->key2cvsauthor[key] << "\n";
+	std::map<std::string, std::string>::const_iterator ca_it = c->s->key2cvsauthor.find(key);
+	if (ca_it != c->s->key2cvsauthor.end()) {
+	    //std::cout << "Found author: " << ca_it->second << "\n";
 	    if (!have_ret) {
 		cvsmsg.append("\n");
 	    }
-	    std::string svnname = std::string("svn:account:") + c->s->key2cvsauthor[key];
-	    std::string cvsaccount = std::string("cvs:account:") + c->s->key2cvsauthor[key];
+	    std::string svnname = std::string("svn:account:") + ca_it->second;
+	    std::string cvsaccount = std::string("cvs:account:") + ca_it->second;
 	    size_t index = cvsmsg.find(svnname);
 	    if (index != std::string::npos) {
-		std::cout << "Replacing svn:account\n";
+		replaced_account = true;
 		cvsmsg.replace(index, cvsaccount.length(), cvsaccount);
 	    } else {
 		cvsmsg.append(cvsaccount);
@@ -759,16 +787,66 @@ commit_msg(git_commit_data *c)
 	nmsg = cvsmsg;
     }
 
-    return nmsg;
+    return arena.store(nmsg);
 }
 
-int
-write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::ifstream &infile)
+// Whether c is written out as a commit (with a message)
+static inline bool
+commit_has_record(git_commit_data *c)
+{
+    return (!c->skip_commit && !c->reset_commit && !c->notes_commit);
+}
+
+// Work out c's final message now, if that wasn't done ahead of time
+static void
+commit_render_msg(git_commit_data *c)
 {
-    if (!infile.good()) {
-        return -1;
+    if (c->have_out_msg)
+	return;
+    c->out_msg = commit_msg(c, c->s->strings, c->out_msg_replaced_account);
+    c->have_out_msg = true;
+}
+
+// Work out the final messages of all the commits that will be written, on
+// as many threads as we have, so writing them out is just a copy.  Each
+// batch of commits gets an arena of its own for the rendered text, which is
+// handed over to s once everything is done.
+#define FI_RENDER_BATCH 1024
+
+static void
+render_commits(git_fi_data *s, std::vector<git_commit_data> &commits)
+{
+    size_t nbatches = (commits.size() + FI_RENDER_BATCH - 1) / FI_RENDER_BATCH;
+    std::vector<fi_arena> arenas(nbatches);
+    fi_parallel_for(nbatches, s->threads, [&](size_t b) {
+	fi_span span("render batch");
+	size_t end = std::min((b + 1) * FI_RENDER_BATCH, commits.size());
+	for (size_t i = b * FI_RENDER_BATCH; i < end; i++) {
+	    git_commit_data *c = &commits[i];
+	    if (!commit_has_record(c))
+		continue;
+	    c->out_msg = commit_msg(c, arenas[b], c->out_msg_replaced_account);
+	    c->have_out_msg = true;
+	}
+	fi_meter.add(end - b * FI_RENDER_BATCH);
+    });
+    for (size_t b = 0; b < nbatches; b++) {
+	s->strings.adopt(arenas[b]);
     }
+}
+
+int
+git_render_commit_msgs(git_fi_data *s)
+{
+    render_commits(s, s->commits);
+    render_commits(s, s->splice_commits);
+    return 0;
+}
 
+// Write a single commit - write_commit takes care of any splices
+static int
+write_commit_data(git_fi_writer &outfile, git_commit_data *c, git_fi_data *d)
+{
     if (c->skip_commit)
 	return 0;
 
@@ -784,10 +862,10 @@ write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::if
 
 #if 0
     // If this is a rebuild, write the blobs first
-    if (c->id.sha1.length()) {
-	if (c->s->rebuild_commits.find(c->id.sha1) != c->s->rebuild_commits.end()) {
+    if (!c->id.sha1.is_null()) {
+	if (c->s->rebuild_commits.find(c->id.sha1.hex()) != c->s->rebuild_commits.end()) {
 	    std::cout << "rebuild commit!\n";
-	    std::string sha1blobs = c->id.sha1 + std::string("-blob.fi");
+	    std::string sha1blobs = c->id.sha1.hex() + std::string("-blob.fi");
 	    std::ifstream s1b(sha1blobs, std::ifstream::binary | std::ios::ate);
 	    std::streamsize size = s1b.tellg();
 	    s1b.seekg(0, std::ios::beg);
@@ -812,7 +890,7 @@ write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::if
     }
     outfile << "mark :" << c->id.mark << "\n";
 #if 0
-    if (c->id.sha1.length()) {
+    if (!c->id.sha1.is_null()) {
 	outfile << "original-oid " << c->id.sha1 << "\n";
     }
 #endif
@@ -823,29 +901,24 @@ write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::if
     }
     outfile << "committer " << c->committer << " " << c->committer_timestamp << "\n";
 
-    std::string nmsg = commit_msg(c);
-    outfile << "data " << nmsg.length() << "\n";
-    outfile << nmsg;
+    commit_render_msg(c);
+    outfile << "data " << c->out_msg.length() << "\n";
+    outfile << c->out_msg;
 
     if (c->from.mark != -1) {
-	// Check to see if a commit was spliced in between this commit and its from commit.
-	if (d->splice_map.find(c->from.mark) != d->splice_map.end()) {
-	    git_commit_data &cd = d->splice_commits[c->from.mark];
-	    outfile << "from :" << cd.id.mark << "\n";
-	} else {
-	    outfile << "from :" << c->from.mark << "\n";
-	}
+	outfile << "from :" << c->from.mark << "\n";
     }
     for (size_t i = 0; i < c->merges.size(); i++) {
 	outfile << "merge :" << c->merges[i].mark << "\n";
     }
 
     bool write_ops = true;
-    if (c->id.sha1.length()) {
-	if ((c->s->rebuild_commits.find(c->id.sha1) != c->s->rebuild_commits.end()) ||
-		(c->s->reset_commits.find(c->id.sha1) != c->s->reset_commits.end())) {
+    if (!c->id.sha1.is_null() && (c->s->rebuild_commits.size() || c->s->reset_commits.size())) {
+	std::string sha1 = c->id.sha1.hex();
+	if ((c->s->rebuild_commits.find(sha1) != c->s->rebuild_commits.end()) ||
+		(c->s->reset_commits.find(sha1) != c->s->reset_commits.end())) {
 	    write_ops = false;
-	    std::string sha1tree = std::string("trees/") + c->id.sha1 + std::string("-tree.fi");
+	    std::string sha1tree = std::string("trees/") + sha1 + std::string("-tree.fi");
 	    std::ifstream s1t(sha1tree, std::ifstream::binary | std::ios::ate);
 	    std::streamsize size = s1t.tellg();
 	    s1t.seekg(0, std::ios::beg);
@@ -866,22 +939,67 @@ write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::if
     }
     outfile << "\n";
 
-    // If there is a splice commit that follows this one, write it out now.
-    if (d->splice_map.find(c->id.mark) != d->splice_map.end()) {
-	std::cout << "Found splice commit to follow " << c->id.sha1 << "\n";
-	long s1 = d->mark_to_index[d->splice_map[c->id.mark]];
-	long scind = s1 - d->commits.size();
-	if (scind < 0) {
+    return 0;
+}
+
+// Report anything of note about writing c and the splice commits following
+// it.  This is kept apart from the writing itself, so output written on
+// several threads can still be reported in commit order.  (It also makes
+// sure the messages have been worked out, so the writing leaves the
+// commits alone.)
+void
+write_commit_notices(git_commit_data *c, git_fi_data *d)
+{
+    if (commit_has_record(c)) {
+	commit_render_msg(c);
+	if (c->out_msg_replaced_account) {
+	    std::cout << "Replacing svn:account\n";
+	}
+    }
+
+    long sind = d->splice_after(c->id.index);
+    if (sind < 0)
+	return;
+    std::cout << "Found splice commit to follow " << c->id.sha1 << "\n";
+    for (; sind >= 0; sind = d->splice_after(sind)) {
+	git_commit_data *sc = d->commit_at(sind);
+	if (sc && commit_has_record(sc)) {
+	    commit_render_msg(sc);
+	    if (sc->out_msg_replaced_account) {
+		std::cout << "Replacing svn:account\n";
+	    }
+	}
+    }
+}
+
+// Write c and any splice commits following it, without the notices
+int
+write_commit_quiet(git_fi_writer &outfile, git_commit_data *c, git_fi_data *d)
+{
+    if (write_commit_data(outfile, c, d))
+	return -1;
+
+    // If there are splice commits following this one, write them out now.
+    long sind = d->splice_after(c->id.index);
+    for (; sind >= 0; sind = d->splice_after(sind)) {
+	git_commit_data *sc = d->commit_at(sind);
+	if (!sc) {
 	    std::cerr << "Couldn't find splice commit\n";
 	    exit(1);
 	}
-	git_commit_data *sc = &d->splice_commits[scind];
-	write_commit(outfile, sc, d, infile);
+	if (write_commit_data(outfile, sc, d))
+	    return -1;
     }
 
     return 0;
 }
 
+int
+write_commit(git_fi_writer &outfile, git_commit_data *c, git_fi_data *d)
+{
+    write_commit_notices(c, d);
+    return write_commit_quiet(outfile, c, d);
+}
 
 // Local Variables:
 // tab-width: 8
@@ -0,0 +1,442 @@
+/*                    C O M P R E S S . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file compress.cpp
+ *
+ * Streaming gzip and zstd compression for fast-import streams.  Large
+ * exports are usually kept compressed, and neither direction ever needs
+ * the whole uncompressed stream in memory or on disk - input is
+ * decompressed a buffer at a time as the reader asks for it, and output is
+ * compressed as the writer flushes it.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "repowork.h"
+
+#define FI_COMPRESS_BUFSIZE (256*1024)
+
+fi_compression
+fi_detect_compression(const char *magic, size_t len)
+{
+    const unsigned char *m = (const unsigned char *)magic;
+    if (len >= 2 && m[0] == 0x1f && m[1] == 0x8b)
+	return fi_compress_gzip;
+    if (len >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f && m[3] == 0xfd)
+	return fi_compress_zstd;
+    return fi_compress_none;
+}
+
+static bool
+fi_compression_supported(fi_compression c)
+{
+    switch (c) {
+	case fi_compress_gzip:
+#ifdef HAVE_ZLIB
+	    return true;
+#else
+	    std::cerr << "repowork was built without gzip support\n";
+	    return false;
+#endif
+	case fi_compress_zstd:
+#ifdef HAVE_ZSTD
+	    return true;
+#else
+	    std::cerr << "repowork was built without zstd support\n";
+	    return false;
+#endif
+	default:
+	    return true;
+    }
+}
+
+int
+fi_output_compression(fi_compression &c, const std::string &path, const std::string &type)
+{
+    c = fi_compress_none;
+    if (type.length()) {
+	if (type == std::string("gzip") || type == std::string("gz")) {
+	    c = fi_compress_gzip;
+	} else if (type == std::string("zstd") || type == std::string("zst")) {
+	    c = fi_compress_zstd;
+	} else if (type != std::string("none")) {
+	    std::cerr << "Unknown compression type: " << type << "\n";
+	    return -1;
+	}
+    } else {
+	std::string_view p(path);
+	if (p.length() > 3 && p.substr(p.length() - 3) == std::string_view(".gz"))
+	    c = fi_compress_gzip;
+	if (p.length() > 4 && p.substr(p.length() - 4) == std::string_view(".zst"))
+	    c = fi_compress_zstd;
+    }
+    return (fi_compression_supported(c)) ? 0 : -1;
+}
+
+fi_decompressor::~fi_decompressor()
+{
+    close();
+}
+
+int
+fi_decompressor::open(fi_compression t, int fd, const char *prefix, size_t plen)
+{
+    close();
+    if (!fi_compression_supported(t))
+	return -1;
+
+    switch (t) {
+#ifdef HAVE_ZLIB
+	case fi_compress_gzip:
+	    {
+		z_stream *z = new z_stream;
+		memset(z, 0, sizeof(z_stream));
+		// (32 - accept either a zlib or a gzip header)
+		if (inflateInit2(z, 15 + 32) != Z_OK) {
+		    std::cerr << "Could not start gzip decompression\n";
+		    delete z;
+		    return -1;
+		}
+		ctx = z;
+	    }
+	    break;
+#endif
+#ifdef HAVE_ZSTD
+	case fi_compress_zstd:
+	    ctx = ZSTD_createDStream();
+	    if (!ctx) {
+		std::cerr << "Could not start zstd decompression\n";
+		return -1;
+	    }
+	    break;
+#endif
+	default:
+	    return -1;
+    }
+
+    type = t;
+    ifd = fd;
+    in.resize(std::max((size_t)FI_COMPRESS_BUFSIZE, plen));
+    memcpy(in.data(), prefix, plen);
+    in_pos = 0;
+    in_len = plen;
+    in_eof = false;
+    need_input = false;
+    finished = false;
+    return 0;
+}
+
+void
+fi_decompressor::close()
+{
+    if (ctx) {
+	switch (type) {
+#ifdef HAVE_ZLIB
+	    case fi_compress_gzip:
+		inflateEnd((z_stream *)ctx);
+		delete (z_stream *)ctx;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	    case fi_compress_zstd:
+		ZSTD_freeDStream((ZSTD_DStream *)ctx);
+		break;
+#endif
+	    default:
+		break;
+	}
+    }
+    ctx = NULL;
+    type = fi_compress_none;
+    ifd = -1;
+    in.clear();
+    in_pos = in_len = 0;
+}
+
+bool
+fi_decompressor::refill()
+{
+    while (true) {
+	ssize_t r = ::read(ifd, in.data(), in.size());
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r < 0) {
+	    std::cerr << "Error reading compressed input\n";
+	    return false;
+	}
+	in_pos = 0;
+	in_len = r;
+	in_eof = (r == 0);
+	return true;
+    }
+}
+
+ssize_t
+fi_decompressor::read(char *dst, size_t len)
+{
+    if (!ctx)
+	return -1;
+
+    size_t produced = 0;
+    while (!produced && len) {
+	// The decompressor may still have output to give after using up its
+	// input, so more input is only read once it stops filling the output
+	if (in_pos == in_len && need_input) {
+	    if (!in_eof && !refill())
+		return -1;
+	    if (in_eof) {
+		if (!finished) {
+		    std::cerr << "Compressed input is truncated\n";
+		    return -1;
+		}
+		return 0;
+	    }
+	}
+
+	switch (type) {
+#ifdef HAVE_ZLIB
+	    case fi_compress_gzip:
+		{
+		    z_stream *z = (z_stream *)ctx;
+		    z->next_in = (Bytef *)in.data() + in_pos;
+		    z->avail_in = in_len - in_pos;
+		    z->next_out = (Bytef *)dst;
+		    z->avail_out = len;
+		    int r = inflate(z, Z_NO_FLUSH);
+		    if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+			std::cerr << "Error decompressing gzip input\n";
+			return -1;
+		    }
+		    if (in_len - z->avail_in > in_pos)
+			finished = false;
+		    in_pos = in_len - z->avail_in;
+		    produced = len - z->avail_out;
+		    need_input = (z->avail_out != 0);
+		    if (r == Z_STREAM_END) {
+			// Concatenated gzip files (such as those written by
+			// parallel compressors) are one stream to us
+			finished = true;
+			inflateReset(z);
+		    }
+		}
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	    case fi_compress_zstd:
+		{
+		    ZSTD_inBuffer ib = {in.data(), in_len, in_pos};
+		    ZSTD_outBuffer ob = {dst, len, 0};
+		    size_t r = ZSTD_decompressStream((ZSTD_DStream *)ctx, &ob, &ib);
+		    if (ZSTD_isError(r)) {
+			std::cerr << "Error decompressing zstd input: " << ZSTD_getErrorName(r) << "\n";
+			return -1;
+		    }
+		    // (0 is the end of a frame - more frames may follow)
+		    if (ib.pos > in_pos || ob.pos)
+			finished = (r == 0);
+		    in_pos = ib.pos;
+		    produced = ob.pos;
+		    need_input = (ob.pos < len);
+		}
+		break;
+#endif
+	    default:
+		return -1;
+	}
+    }
+
+    return produced;
+}
+
+fi_compressor::~fi_compressor()
+{
+    close();
+}
+
+int
+fi_compressor::open(fi_compression t, int fd, int nthreads)
+{
+    close();
+    if (!fi_compression_supported(t))
+	return -1;
+
+    switch (t) {
+#ifdef HAVE_ZLIB
+	case fi_compress_gzip:
+	    {
+		z_stream *z = new z_stream;
+		memset(z, 0, sizeof(z_stream));
+		// (16 - write a gzip header and trailer)
+		if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		    std::cerr << "Could not start gzip compression\n";
+		    delete z;
+		    return -1;
+		}
+		ctx = z;
+	    }
+	    break;
+#endif
+#ifdef HAVE_ZSTD
+	case fi_compress_zstd:
+	    {
+		ZSTD_CCtx *cctx = ZSTD_createCCtx();
+		if (!cctx) {
+		    std::cerr << "Could not start zstd compression\n";
+		    return -1;
+		}
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+		// Compression is far slower than anything else we do to the
+		// output, so hand it to libzstd's worker threads.  (This fails
+		// harmlessly if the library was built without them.)
+		if (nthreads > 1)
+		    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, nthreads);
+		ctx = cctx;
+	    }
+	    break;
+#endif
+	default:
+	    return -1;
+    }
+
+    (void)nthreads;
+    type = t;
+    ofd = fd;
+    out.resize(FI_COMPRESS_BUFSIZE);
+    return 0;
+}
+
+int
+fi_compressor::close()
+{
+    int ret = 0;
+    if (ctx) {
+	if (!run(NULL, 0, true))
+	    ret = -1;
+	switch (type) {
+#ifdef HAVE_ZLIB
+	    case fi_compress_gzip:
+		deflateEnd((z_stream *)ctx);
+		delete (z_stream *)ctx;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	    case fi_compress_zstd:
+		ZSTD_freeCCtx((ZSTD_CCtx *)ctx);
+		break;
+#endif
+	    default:
+		break;
+	}
+    }
+    ctx = NULL;
+    type = fi_compress_none;
+    ofd = -1;
+    out.clear();
+    return ret;
+}
+
+bool
+fi_compressor::write(const char *s, size_t len)
+{
+    if (!ctx)
+	return false;
+    return run(s, len, false);
+}
+
+bool
+fi_compressor::write_out(const char *s, size_t len)
+{
+    while (len) {
+	ssize_t r = ::write(ofd, s, len);
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r <= 0) {
+	    std::cerr << "Error writing compressed output\n";
+	    return false;
+	}
+	s += r;
+	len -= r;
+    }
+    return true;
+}
+
+// Feed len bytes to the compressor (finishing the stream if end is set),
+// writing out everything it produces
+bool
+fi_compressor::run(const char *s, size_t len, bool end)
+{
+    switch (type) {
+#ifdef HAVE_ZLIB
+	case fi_compress_gzip:
+	    {
+		z_stream *z = (z_stream *)ctx;
+		z->next_in = (Bytef *)s;
+		z->avail_in = len;
+		while (true) {
+		    z->next_out = (Bytef *)out.data();
+		    z->avail_out = out.size();
+		    int r = deflate(z, (end) ? Z_FINISH : Z_NO_FLUSH);
+		    if (r == Z_STREAM_ERROR) {
+			std::cerr << "Error compressing gzip output\n";
+			return false;
+		    }
+		    if (!write_out(out.data(), out.size() - z->avail_out))
+			return false;
+		    if (end && r == Z_STREAM_END)
+			break;
+		    if (!end && !z->avail_in && z->avail_out)
+			break;
+		}
+	    }
+	    return true;
+#endif
+#ifdef HAVE_ZSTD
+	case fi_compress_zstd:
+	    {
+		ZSTD_inBuffer ib = {s, len, 0};
+		while (true) {
+		    ZSTD_outBuffer ob = {out.data(), out.size(), 0};
+		    size_t r = ZSTD_compressStream2((ZSTD_CCtx *)ctx, &ob, &ib, (end) ? ZSTD_e_end : ZSTD_e_continue);
+		    if (ZSTD_isError(r)) {
+			std::cerr << "Error compressing zstd output: " << ZSTD_getErrorName(r) << "\n";
+			return false;
+		    }
+		    if (!write_out(out.data(), ob.pos))
+			return false;
+		    if ((end) ? (r == 0) : (ib.pos == ib.size))
+			break;
+		}
+	    }
+	    return true;
+#endif
+	default:
+	    (void)s;
+	    (void)len;
+	    (void)end;
+	    return false;
+    }
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -16,11 +16,11 @@
 #include "repowork.h"
 
 int
-parse_alias(git_fi_data *fi_data, std::ifstream &infile)
+parse_alias(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 6);  // Remove "alias " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 6);  // Remove "alias " prefix
 
     // For the moment, we don't support aliass so this never works...
     std::cerr << "Unsupported command \"alias\" (specified: : " << line << ")\n";
@@ -29,10 +29,10 @@ parse_alias(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_cat_blob(git_fi_data *fi_data, std::ifstream &infile)
+parse_cat_blob(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support cat_blobs so this never works...
     std::cerr << "Unsupported command \"cat_blob\" - ignored\n";
@@ -41,10 +41,10 @@ parse_cat_blob(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_checkpoint(git_fi_data *fi_data, std::ifstream &infile)
+parse_checkpoint(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support checkpoints so this never works...
     std::cerr << "Unsupported command \"checkpoint\" - ignored\n";
@@ -53,10 +53,10 @@ parse_checkpoint(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_done(git_fi_data *fi_data, std::ifstream &infile)
+parse_done(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support dones so this never works...
     std::cerr << "Unsupported command \"done\"- ignored\n";
@@ -65,11 +65,11 @@ parse_done(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_feature(git_fi_data *fi_data, std::ifstream &infile)
+parse_feature(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 8);  // Remove "feature " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 8);  // Remove "feature " prefix
 
     // For the moment, we don't support any features so this never works...
     std::cerr << "Unsupported command \"feature\" (specified: " << line << ")\n";
@@ -78,10 +78,10 @@ parse_feature(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_get_mark(git_fi_data *fi_data, std::ifstream &infile)
+parse_get_mark(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support get_marks so this never works...
     std::cerr << "Unsupported command \"get_mark\" - ignored\n";
@@ -90,10 +90,10 @@ parse_get_mark(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_ls(git_fi_data *fi_data, std::ifstream &infile)
+parse_ls(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support lss so this never works...
     std::cerr << "Unsupported command \"ls\" - ignored\n";
@@ -102,10 +102,10 @@ parse_ls(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_option(git_fi_data *fi_data, std::ifstream &infile)
+parse_option(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     // For the moment, we don't support options so this never works...
     std::cout << "Unsupported command \"option\" - ignored\n";
@@ -114,10 +114,10 @@ parse_option(git_fi_data *fi_data, std::ifstream &infile)
 }
 
 int
-parse_progress(git_fi_data *fi_data, std::ifstream &infile)
+parse_progress(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
+    std::string_view line;
+    infile.getline(line);
 
     std::cerr << line << "\n";
 
@@ -11,8 +11,10 @@
  *
  */
 
+#include <algorithm>
 #include <string>
 #include <regex>
+#include <unordered_map>
 
 #include "repowork.h"
 
@@ -23,6 +25,7 @@ git_unpack_notes(git_fi_data *s, std::string &repo_path)
     // find its associated blob with data, read it, find the associated
     // commit, and stash it in a string in that container.
     for (size_t i = 0; i < s->commits.size(); i++) {
+	fi_meter.add(1);
 	if (s->commits[i].notes_commit) {
 	    continue;
 	}
@@ -32,18 +35,21 @@ git_unpack_notes(git_fi_data *s, std::string &repo_path)
 	    exit(1);
 	}
 
-	if (!s->commits[i].id.sha1.length()) {
+	if (s->commits[i].id.sha1.is_null()) {
 	    std::cerr << "Warning - commit " << s->commits[i].id.mark << " has no sha1 info, skipping notes lookup\n";
 	    continue;
 	}
 
 	// This is cheap and clunky, but I've not yet found a document
 	// describing how to reliably unpack git notes...
-	std::string git_notes_cmd = std::string("cd ") + repo_path + std::string(" && git log -1 ") + s->commits[i].id.sha1 + std::string(" --pretty=format:\"%N\" > ../sha1.txt && cd ..");
-        if (std::system(git_notes_cmd.c_str())) {
-            std::cout << "git_sha1_cmd failed\n";
-	    exit(-1);
-        }
+	std::string git_notes_cmd = std::string("cd ") + repo_path + std::string(" && git log -1 ") + s->commits[i].id.sha1.hex() + std::string(" --pretty=format:\"%N\" > ../sha1.txt && cd ..");
+	{
+	    fi_span span("git log", git_notes_cmd);
+	    if (std::system(git_notes_cmd.c_str())) {
+		std::cout << "git_sha1_cmd failed\n";
+		exit(-1);
+	    }
+	}
 
 	std::ifstream n("sha1.txt");
 	if (!n.good()) {
@@ -53,7 +59,7 @@ git_unpack_notes(git_fi_data *s, std::string &repo_path)
 	std::string note((std::istreambuf_iterator<char>(n)), std::istreambuf_iterator<char>());
 
 	// Write the message to the commit's note string storage;
-	s->commits[i].notes_string = note;
+	s->commits[i].notes_string = s->store(note);
 
 	n.close();
     }
@@ -61,6 +67,105 @@ git_unpack_notes(git_fi_data *s, std::string &repo_path)
     return 0;
 }
 
+// Get the notes from the notes commits in the stream itself, rather than
+// from the repository.  fast-export writes the notes tree changes of each
+// notes commit as file operations, with one file per annotated commit named
+// by that commit's SHA1 (possibly split up into fanout directories.)  The
+// notes in place at the end of the notes history are the ones that apply.
+int
+git_stream_notes(git_fi_data *s, git_fi_reader &infile)
+{
+    if (!s->have_sha1s) {
+	std::cerr << "Fatal - notes unpacking requested, but don't have original sha1 ids - redo fast-export with the --show-original-ids option.\n";
+	exit(1);
+    }
+
+    std::unordered_map<git_oid, long, git_oid_hash> notes; // commit -> blob index
+    for (size_t i = 0; i < s->commits.size(); i++) {
+	git_commit_data &c = s->commits[i];
+	if (!c.notes_commit)
+	    continue;
+	for (size_t j = 0; j < c.fileops.size(); j++) {
+	    git_op &o = c.fileops[j];
+	    if (o.type == filedeleteall) {
+		notes.clear();
+		continue;
+	    }
+	    std::string hex;
+	    std::string_view p = s->paths.str(o.path);
+	    for (size_t k = 0; k < p.length(); k++) {
+		if (p[k] != '/')
+		    hex.push_back(p[k]);
+	    }
+	    git_oid target;
+	    if (!target.from_hex(hex)) {
+		std::cerr << "Warning - notes commit " << c.id.mark << " has non-note file " << p << ", skipping\n";
+		continue;
+	    }
+	    if (o.type == filedelete) {
+		notes.erase(target);
+		continue;
+	    }
+	    if (o.type != filemodify)
+		continue;
+	    long bmark = o.dataref.mark;
+	    if (!o.dataref.sha1.is_null()) {
+		const long *m = s->sha1_to_mark.find(o.dataref.sha1);
+		bmark = (m) ? *m : -1;
+	    }
+	    if (s->marks.type(bmark) != mark_blob) {
+		std::cerr << "Warning - note for " << target << " refers to an unknown blob, skipping\n";
+		continue;
+	    }
+	    notes[target] = s->marks.index(bmark);
+	}
+    }
+
+    // Match up the notes with their commits, in input order (unmapped inputs
+    // can only give back their blob contents going forward.)
+    std::vector<std::pair<git_blob_data *, git_commit_data *>> found;
+    for (size_t i = 0; i < s->commits.size(); i++) {
+	git_commit_data &c = s->commits[i];
+	if (c.notes_commit || c.id.sha1.is_null())
+	    continue;
+	std::unordered_map<git_oid, long, git_oid_hash>::iterator n_it = notes.find(c.id.sha1);
+	if (n_it != notes.end())
+	    found.push_back(std::make_pair(&s->blobs[n_it->second], &c));
+    }
+    std::sort(found.begin(), found.end(), [](const std::pair<git_blob_data *, git_commit_data *> &a, const std::pair<git_blob_data *, git_commit_data *> &b) {
+	return a.first->offset < b.first->offset;
+    });
+
+    bool rewound = false;
+    for (size_t i = 0; i < found.size(); i++) {
+	git_blob_data *b = found[i].first;
+	std::string_view note;
+	if (b->cbuffer) {
+	    note = std::string_view(b->cbuffer, b->length);
+	} else if (infile.mapped()) {
+	    note = infile.view(b->offset, b->length);
+	} else {
+	    if (!rewound && infile.rewind()) {
+		std::cerr << "Could not reread input for notes\n";
+		exit(1);
+	    }
+	    rewound = true;
+	    if (b->offset >= infile.tell()) {
+		infile.skip(b->offset - infile.tell());
+		note = infile.read(b->length);
+	    }
+	}
+	if (note.length() != b->length) {
+	    std::cerr << "Could not read note for " << found[i].second->id.sha1 << "\n";
+	    exit(1);
+	}
+	// (Stored right away - unmapped input views don't last)
+	found[i].second->notes_string = s->store(note);
+    }
+
+    return 0;
+}
+
 // Parse notes data looking for commit information
 int
 git_parse_notes(git_fi_data *s)
@@ -81,11 +186,10 @@ git_parse_notes(git_fi_data *s)
 	// should reflect the original SVN history in the metadata.  Undo
 	// the mapping for the label based on revision number.
 	if (s->commits[i].svn_id.length()) {
-	    long revnum = std::stol(s->commits[i].svn_id);
+	    long revnum = fi_stol(s->commits[i].svn_id);
 	    if (revnum < 36472) {
-		if (s->commits[i].svn_branches.find(std::string("dmtogl")) != s->commits[i].svn_branches.end()) {
-		    s->commits[i].svn_branches.erase(std::string("dmtogl"));
-		    s->commits[i].svn_branches.insert(std::string("dmtogl-branch"));
+		if (fi_label_erase(s->commits[i].svn_branches, "dmtogl")) {
+		    fi_label_insert(s->commits[i].svn_branches, "dmtogl-branch");
 		}
 		update_commit_msg(&s->commits[i]);
 	    }
@@ -0,0 +1,176 @@
+/*                   P R O G R E S S . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file progress.cpp
+ *
+ * Live progress display on stderr (--progress).  The processing code only
+ * bumps counters - all of the timing, rate and ETA work and the printing is
+ * done by a ticker thread of its own.
+ *
+ */
+
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "repowork.h"
+
+// How often the display is updated, and how often a line is logged when
+// stderr isn't a terminal (milliseconds)
+#define FI_PROGRESS_INTERVAL 500
+#define FI_PROGRESS_LOG_INTERVAL 10000
+
+fi_progress fi_meter;
+
+static int64_t
+progress_now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string
+progress_time(double s)
+{
+    long t = (long)(s + 0.5);
+    char buf[64];
+    if (t >= 3600) {
+	snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", t / 3600, (t / 60) % 60, t % 60);
+    } else {
+	snprintf(buf, sizeof(buf), "%ld:%02ld", t / 60, t % 60);
+    }
+    return std::string(buf);
+}
+
+fi_progress::~fi_progress()
+{
+    stop();
+}
+
+void
+fi_progress::start()
+{
+    if (on)
+	return;
+    tty = isatty(STDERR_FILENO);
+    t_start = progress_now();
+    stopping = false;
+    on = true;
+    ticker = std::thread([this]() { run(); });
+}
+
+void
+fi_progress::stop()
+{
+    if (!on)
+	return;
+    {
+	std::lock_guard<std::mutex> lock(m);
+	stopping = true;
+    }
+    cv.notify_all();
+    ticker.join();
+    on = false;
+
+    // Clear the display away, so it doesn't get mixed up with whatever is
+    // printed next
+    if (tty && last_len)
+	fprintf(stderr, "\r%-*s\r", (int)last_len, "");
+    last_len = 0;
+}
+
+void
+fi_progress::phase(const char *name, size_t ntotal, bool nbytes)
+{
+    if (!on)
+	return;
+    done.store(0, std::memory_order_relaxed);
+    total.store(ntotal, std::memory_order_relaxed);
+    bytes.store(nbytes, std::memory_order_relaxed);
+    t_phase.store(progress_now(), std::memory_order_relaxed);
+    pname.store(name, std::memory_order_release);
+}
+
+void
+fi_progress::run()
+{
+    int64_t last_log = progress_now();
+    std::unique_lock<std::mutex> lock(m);
+    while (!stopping) {
+	cv.wait_for(lock, std::chrono::milliseconds(FI_PROGRESS_INTERVAL));
+	if (stopping)
+	    break;
+	int64_t now = progress_now();
+	if (!tty && now - last_log < FI_PROGRESS_LOG_INTERVAL)
+	    continue;
+	last_log = now;
+	show(now);
+    }
+}
+
+void
+fi_progress::show(int64_t now)
+{
+    const char *name = pname.load(std::memory_order_acquire);
+    if (!name)
+	return;
+    size_t d = done.load(std::memory_order_relaxed);
+    size_t t = total.load(std::memory_order_relaxed);
+    bool b = bytes.load(std::memory_order_relaxed);
+    double secs = (now - t_phase.load(std::memory_order_relaxed)) / 1000.0;
+    // (Counts may briefly run past the total as a phase changes over)
+    if (t && d > t)
+	d = t;
+
+    std::string line = std::string("[") + progress_time((now - t_start) / 1000.0) + std::string("] ") + std::string(name);
+    char buf[128];
+    if (b) {
+	if (t) {
+	    snprintf(buf, sizeof(buf), ": %.1f of %.1f MB (%.0f%%)", d / 1048576.0, t / 1048576.0, 100.0 * d / t);
+	} else {
+	    snprintf(buf, sizeof(buf), ": %.1f MB", d / 1048576.0);
+	}
+	line.append(buf);
+	if (secs > 0 && d) {
+	    snprintf(buf, sizeof(buf), ", %.1f MB/s", d / 1048576.0 / secs);
+	    line.append(buf);
+	}
+    } else if (t || d) {
+	if (t) {
+	    snprintf(buf, sizeof(buf), ": %zu of %zu (%.0f%%)", d, t, 100.0 * d / t);
+	} else {
+	    snprintf(buf, sizeof(buf), ": %zu", d);
+	}
+	line.append(buf);
+	if (secs > 0 && d) {
+	    snprintf(buf, sizeof(buf), ", %.0f/s", d / secs);
+	    line.append(buf);
+	}
+    }
+    if (t && d && secs > 0) {
+	line.append(", ETA ");
+	line.append(progress_time((t - d) * secs / d));
+    }
+
+    if (tty) {
+	// Overwrite the previous update in place
+	size_t len = line.length();
+	fprintf(stderr, "\r%-*s", (int)last_len, line.c_str());
+	last_len = len;
+    } else {
+	fprintf(stderr, "%s\n", line.c_str());
+    }
+    fflush(stderr);
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,369 @@
+/*                      R E A D E R . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file reader.cpp
+ *
+ * Input handling for fast-import streams.  Regular files are memory
+ * mapped, so lines and data payloads can be handed to the parsers as
+ * views straight into the mapping without any copying.  Anything that
+ * can't be mapped (pipes, stdin) is read through a sliding buffer.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "repowork.h"
+
+#define FI_READER_BUFSIZE (1024*1024)
+// Payloads smaller than this are copied through the output buffer
+#define FI_COPY_MIN (64*1024)
+
+git_fi_reader::~git_fi_reader()
+{
+    close();
+}
+
+int
+git_fi_reader::open(const char *path)
+{
+    if (std::string_view(path) == std::string_view("-"))
+	return open_fd(STDIN_FILENO, false);
+
+    int nfd = ::open(path, O_RDONLY);
+    if (nfd < 0) {
+	std::cerr << "Could not open input file: " << path << "\n";
+	return -1;
+    }
+    return open_fd(nfd, true);
+}
+
+int
+git_fi_reader::open_fd(int nfd, bool owned)
+{
+    close();
+    ifd = nfd;
+    own_fd = owned;
+
+    // Input is read front to back (blob contents, which are copied from
+    // the descriptor rather than the mapping, included.)
+    struct stat sb;
+    bool regular = (fstat(ifd, &sb) == 0 && S_ISREG(sb.st_mode));
+    if (regular)
+	posix_fadvise(ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (regular && sb.st_size > 0) {
+	// A mapping is no use for compressed files
+	char magic[4];
+	ssize_t mlen = pread(ifd, magic, sizeof(magic), 0);
+	bool compressed = (mlen > 0 && fi_detect_compression(magic, mlen) != fi_compress_none);
+	void *m = (compressed) ? MAP_FAILED : mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, ifd, 0);
+	if (m != MAP_FAILED) {
+	    map = (const char *)m;
+	    map_len = sb.st_size;
+	    own_map = true;
+	    madvise(m, map_len, MADV_SEQUENTIAL);
+	    return 0;
+	}
+    }
+
+    // Not something we can map - fall back to buffered reads.  Files can
+    // at least be read again from the start.
+    reopenable = regular;
+    return open_buffered();
+}
+
+// Set up for buffered reading from the start of the input, decompressing
+// it if need be
+int
+git_fi_reader::open_buffered()
+{
+    buf.resize(FI_READER_BUFSIZE);
+    fill(4);
+    fi_compression c = fi_detect_compression(buf.data(), bend);
+    if (c == fi_compress_none)
+	return 0;
+
+    // What has been read so far is the start of the compressed data
+    dec = new fi_decompressor;
+    if (dec->open(c, ifd, buf.data(), bend)) {
+	close();
+	return -1;
+    }
+    bend = 0;
+    eof = false;
+    return 0;
+}
+
+int
+git_fi_reader::rewind()
+{
+    if (map) {
+	pos = 0;
+	line_pos = line_len = std::string::npos;
+	return 0;
+    }
+    if (!reopenable || lseek(ifd, 0, SEEK_SET) < 0)
+	return -1;
+    delete dec;
+    dec = NULL;
+    pos = bend = boffset = 0;
+    line_pos = line_len = std::string::npos;
+    eof = false;
+    return open_buffered();
+}
+
+int
+git_fi_reader::open_range(const git_fi_reader &src, size_t start, size_t end)
+{
+    close();
+    if (!src.map || start > end || end > src.map_len)
+	return -1;
+    ifd = src.ifd;
+    map = src.map;
+    map_len = end;
+    pos = start;
+    return 0;
+}
+
+void
+git_fi_reader::close()
+{
+    if (map && own_map)
+	munmap((void *)map, map_len);
+    if (ifd >= 0 && own_fd)
+	::close(ifd);
+    map = NULL;
+    map_len = 0;
+    delete dec;
+    dec = NULL;
+    reopenable = false;
+    ifd = -1;
+    own_fd = false;
+    own_map = false;
+    pos = 0;
+    line_pos = line_len = std::string::npos;
+    buf.clear();
+    bend = 0;
+    boffset = 0;
+    eof = false;
+}
+
+// Make sure at least n bytes past the current position are in the buffer
+// (or that we've hit the end of the input trying.)
+void
+git_fi_reader::fill(size_t n)
+{
+    while (bend - pos < n && !eof) {
+	if (pos) {
+	    // Slide the unread data to the front of the buffer
+	    memmove(buf.data(), buf.data() + pos, bend - pos);
+	    bend -= pos;
+	    boffset += pos;
+	    pos = 0;
+	    line_pos = line_len = std::string::npos;
+	}
+	if (bend + n > buf.size() || bend == buf.size())
+	    buf.resize(std::max(buf.size() * 2, bend + n));
+	ssize_t r = (dec) ? dec->read(buf.data() + bend, buf.size() - bend) : ::read(ifd, buf.data() + bend, buf.size() - bend);
+	if (r < 0 && dec) {
+	    // Corrupt or truncated - carrying on would quietly lose the rest
+	    // of the input
+	    exit(1);
+	}
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r <= 0) {
+	    eof = true;
+	    break;
+	}
+	bend += r;
+    }
+}
+
+bool
+git_fi_reader::peek_line(std::string_view &line)
+{
+    if (line_pos == pos) {
+	line = std::string_view(data() + pos, line_len);
+	return true;
+    }
+
+    if (map) {
+	if (pos >= map_len)
+	    return false;
+	const char *s = map + pos;
+	const char *e = (const char *)memchr(s, '\n', map_len - pos);
+	line_len = (e) ? (size_t)(e - s) : map_len - pos;
+	line_pos = pos;
+	line = std::string_view(s, line_len);
+	return true;
+    }
+
+    size_t scanned = 0;
+    while (true) {
+	const char *s = buf.data() + pos;
+	const char *e = (const char *)memchr(s + scanned, '\n', bend - pos - scanned);
+	if (e) {
+	    line_len = e - s;
+	    break;
+	}
+	scanned = bend - pos;
+	if (eof) {
+	    if (!scanned)
+		return false;
+	    line_len = scanned;
+	    break;
+	}
+	fill(scanned + 1);
+    }
+    line_pos = pos;
+    line = std::string_view(buf.data() + pos, line_len);
+    return true;
+}
+
+bool
+git_fi_reader::getline(std::string_view &line)
+{
+    if (!peek_line(line))
+	return false;
+    pos += line_len;
+    // Step over the newline, if there is one
+    if (map) {
+	if (pos < map_len)
+	    pos++;
+    } else {
+	if (pos < bend)
+	    pos++;
+    }
+    return true;
+}
+
+std::string_view
+git_fi_reader::read(size_t n)
+{
+    const char *s;
+    if (map) {
+	n = std::min(n, map_len - std::min(pos, map_len));
+	s = map + pos;
+    } else {
+	fill(n);
+	n = std::min(n, bend - pos);
+	s = buf.data() + pos;
+    }
+    pos += n;
+    return std::string_view(s, n);
+}
+
+void
+git_fi_reader::skip(size_t n)
+{
+    if (map) {
+	pos = std::min(pos + n, map_len);
+	return;
+    }
+    while (n) {
+	fill(1);
+	size_t avail = bend - pos;
+	if (!avail)
+	    return;
+	size_t step = std::min(n, avail);
+	pos += step;
+	n -= step;
+    }
+}
+
+size_t
+git_fi_reader::copy(git_fi_writer &out, size_t n)
+{
+    if (map) {
+	size_t copied = copy_range(out, pos, n);
+	pos += copied;
+	return copied;
+    }
+
+    // Whatever we've already buffered goes first
+    size_t copied = std::min(n, bend - pos);
+    out.write(buf.data() + pos, copied);
+    pos += copied;
+    n -= copied;
+    if (!n)
+	return copied;
+
+    // Compressed data has to come through the buffer, to be decompressed
+    // on the way
+    if (dec) {
+	while (n) {
+	    fill(std::min(n, (size_t)FI_READER_BUFSIZE));
+	    size_t avail = std::min(n, bend - pos);
+	    if (!avail)
+		break;
+	    out.write(buf.data() + pos, avail);
+	    pos += avail;
+	    copied += avail;
+	    n -= avail;
+	}
+	return copied;
+    }
+
+    // The rest can go straight to the output from the input descriptor
+    boffset += bend;
+    pos = bend = 0;
+    line_pos = line_len = std::string::npos;
+    size_t c = out.copy_from(ifd, NULL, n);
+    boffset += c;
+    if (c < n)
+	eof = true;
+    return copied + c;
+}
+
+size_t
+git_fi_reader::copy_range(git_fi_writer &out, size_t offset, size_t n)
+{
+    if (!map) {
+	// Skip ahead to the data and pass it along from there
+	if (offset < tell())
+	    return 0;
+	skip(offset - tell());
+	return (tell() == offset) ? copy(out, n) : 0;
+    }
+
+    if (offset > map_len)
+	return 0;
+    n = std::min(n, map_len - offset);
+
+    // Small payloads are cheaper to copy into the output buffer than to
+    // flush the buffer for.  Anything bigger is left for the kernel to
+    // move, rather than writing it out of the mapping.
+    if (n < FI_COPY_MIN) {
+	out.write(map + offset, n);
+	return n;
+    }
+    off_t off = offset;
+    return out.copy_from(ifd, &off, n);
+}
+
+std::string_view
+git_fi_reader::view(size_t offset, size_t len) const
+{
+    if (!map || offset > map_len)
+	return std::string_view();
+    return std::string_view(map + offset, std::min(len, map_len - offset));
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -16,218 +16,503 @@
 #include <sstream>
 #include <locale>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "cxxopts.hpp"
 #include "repowork.h"
 
 
-typedef int (*gitcmd_t)(git_fi_data *, std::ifstream &);
-
-gitcmd_t
-gitit_find_cmd(std::string &line, std::map<std::string, gitcmd_t> &cmdmap)
+// Top level commands.  The only difference between the main input and the
+// splice/replace/add inputs is how their commits are handled.
+template <fi_parse_mode M>
+static constexpr auto fi_cmds = fi_cmd_table_make<git_fi_data>({
+    {"alias", parse_alias},
+    {"blob", parse_blob},
+    {"cat-blob", parse_cat_blob},
+    {"checkpoint", parse_checkpoint},
+    {"commit ", parse_commit<M>},
+    {"done", parse_done},
+    {"feature", parse_feature},
+    {"get-mark", parse_get_mark},
+    {"ls", parse_ls},
+    {"option", parse_option},
+    {"progress", parse_progress},
+    {"reset", parse_reset},
+    {"tag", parse_tag}
+});
+
+// Process the next command in the input.  Returns false once the input
+// is exhausted.
+template <fi_parse_mode M>
+bool
+parse_fi_cmd(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    gitcmd_t gc = NULL;
-    std::map<std::string, gitcmd_t>::iterator c_it;
-    for (c_it = cmdmap.begin(); c_it != cmdmap.end(); c_it++) {
-	if (!ficmp(line, c_it->first)) {
-	    gc = c_it->second;
-	    break;
-	}
+    std::string_view line;
+    if (!infile.peek_line(line)) {
+	return false;
+    }
+
+    // Skip empty lines and anything we don't recognize
+    auto gc = fi_cmds<M>.find(line);
+    if (!gc) {
+	//std::cerr << "Unsupported command!\n";
+	infile.getline(line);
+	return true;
     }
-    return gc;
+
+    // If we found a command, process it
+    //std::cout << "line: " << line << "\n";
+    // some commands have data on the command line - the callback
+    // gets the line from the reader and handles it.
+    size_t offset = infile.tell();
+    (*gc)(fi_data, infile);
+    if (infile.tell() == offset) {
+	// Callback didn't know what to do with the line either -
+	// skip it so we don't keep coming back to it.
+	infile.getline(line);
+    }
+
+    return true;
 }
 
+template <fi_parse_mode M>
 int
-parse_fi_file(git_fi_data *fi_data, std::ifstream &infile)
+parse_fi_file(git_fi_data *fi_data, git_fi_reader &infile)
 {
-    std::map<std::string, gitcmd_t> cmdmap;
-    cmdmap[std::string("alias")] = parse_alias;
-    cmdmap[std::string("blob")] = parse_blob;
-    cmdmap[std::string("cat-blob")] = parse_cat_blob;
-    cmdmap[std::string("checkpoint")] = parse_checkpoint;
-    cmdmap[std::string("commit ")] = parse_commit;
-    cmdmap[std::string("done")] = parse_done;
-    cmdmap[std::string("feature")] = parse_feature;
-    cmdmap[std::string("get-mark")] = parse_get_mark;
-    cmdmap[std::string("ls")] = parse_ls;
-    cmdmap[std::string("option")] = parse_option;
-    cmdmap[std::string("progress")] = parse_progress;
-    cmdmap[std::string("reset")] = parse_reset;
-    cmdmap[std::string("tag")] = parse_tag;
-
-    size_t offset = infile.tellg();
-    std::string line;
-    std::map<std::string, gitcmd_t>::iterator c_it;
-    while (std::getline(infile, line)) {
-	// Skip empty lines
-	if (!line.length()) {
-	    offset = infile.tellg();
-	    continue;
-	}
+    while (parse_fi_cmd<M>(fi_data, infile)) {
+	continue;
+    }
+    return 0;
+}
 
-	gitcmd_t gc = gitit_find_cmd(line, cmdmap);
-	if (!gc) {
-	    //std::cerr << "Unsupported command!\n";
-	    offset = infile.tellg();
-	    continue;
+// Progress through the main input is reported every FI_PROGRESS_CMDS
+// commands, so parsers running in parallel don't keep fighting over the
+// counter
+#define FI_PROGRESS_CMDS 256
+
+static int
+parse_main_fi_range(git_fi_data *fi_data, git_fi_reader &infile)
+{
+    size_t last = infile.tell();
+    size_t ncmds = 0;
+    // Paths known before the input (the mode map's) are kept throughout
+    size_t npaths = fi_data->paths.size();
+    while (parse_fi_cmd<fi_parse_normal>(fi_data, infile)) {
+	if (!(++ncmds % FI_PROGRESS_CMDS)) {
+	    size_t pos = infile.tell();
+	    fi_meter.add(pos - last);
+	    last = pos;
 	}
+    }
+    fi_meter.add(infile.tell() - last);
+    return 0;
+}
 
-	// If we found a command, process it
-	//std::cout << "line: " << line << "\n";
-	// some commands have data on the command line - reset seek so the
-	// callback can process it
-	infile.seekg(offset);
-	(*gc)(fi_data, infile);
-	offset = infile.tellg();
+// Fold a staging git_fi_data (see git_fi_data::staging) into fi_data, taking
+// its records in the order they were parsed.
+template <fi_parse_mode M>
+static int
+merge_fi_data(git_fi_data *fi_data, git_fi_data *st)
+{
+    if (st->have_sha1s) {
+	fi_data->have_sha1s = true;
     }
+    fi_data->replace_sha1 = st->replace_sha1;
+
+    std::vector<uint32_t> pmap;
+    for (size_t i = 0; i < st->staged.size(); i++) {
+	long ind = st->staged[i].second;
+	switch (st->staged[i].first) {
+	    case mark_blob:
+		st->blobs[ind].s = fi_data;
+		add_blob(fi_data, st->blobs[ind]);
+		break;
+	    case mark_commit:
+		{
+		    git_commit_data &c = st->commits[ind];
+		    c.s = fi_data;
+		    commit_resolve_staged(&c, st, pmap);
+		    if (c.reset_commit) {
+			add_reset(fi_data, c);
+		    } else {
+			add_commit<M>(fi_data, c);
+		    }
+		}
+		break;
+	    case mark_tag:
+		st->tags[ind].s = fi_data;
+		git_resolve_commitish(st->tags[ind].from, fi_data);
+		add_tag(fi_data, st->tags[ind]);
+		break;
+	    default:
+		break;
+	}
+    }
+
+    // The text of the merged records now belongs to fi_data
+    fi_data->strings.adopt(st->strings);
+    return 0;
+}
 
+// Parse all the fast-import files under dir.  Each file is parsed on its own
+// (on worker threads if we have them) into a staging git_fi_data, and the
+// results are merged in sorted path order - the outcome doesn't depend on
+// the directory iteration order or on thread timing.  Files are handled a
+// batch at a time so there are never too many staged files in memory.
+#define FI_DIR_BATCH 64
+
+template <fi_parse_mode M>
+static int
+parse_fi_dir(git_fi_data *fi_data, const std::filesystem::path &dir)
+{
+    std::vector<std::filesystem::path> files;
+    for (const auto& de : std::filesystem::recursive_directory_iterator(dir)) {
+	if (de.is_regular_file()) {
+	    files.push_back(de.path());
+	}
+    }
+    std::sort(files.begin(), files.end());
+
+    size_t bsize = (size_t)fi_data->threads * FI_DIR_BATCH;
+    std::vector<std::unique_ptr<git_fi_data>> sdata(bsize);
+    for (size_t b = 0; b < files.size(); b += bsize) {
+	size_t bcnt = std::min(bsize, files.size() - b);
+	fi_parallel_for(bcnt, fi_data->threads, [&](size_t i) {
+	    fi_span span("parse file", files[b + i].string());
+	    git_fi_reader sfile;
+	    if (sfile.open(files[b + i].c_str())) {
+		return;
+	    }
+	    sfile.copy_blobs = true;
+	    std::unique_ptr<git_fi_data> st(new git_fi_data);
+	    st->staging = true;
+	    st->replace_sha1 = files[b + i].filename().string();
+	    // Everything stored is text from the file, so its size is as
+	    // much arena as the staged records can need.  Sizing the arena
+	    // to fit keeps the merged arenas from piling up unused space.
+	    std::error_code ec;
+	    size_t fsize = std::filesystem::file_size(files[b + i], ec);
+	    if (!ec) {
+		st->strings.reserve(std::min(fsize, (size_t)FI_ARENA_BLOCK));
+	    }
+	    parse_fi_file<M>(st.get(), sfile);
+	    sdata[i] = std::move(st);
+	});
+
+	fi_span span("merge files");
+	for (size_t i = 0; i < bcnt; i++) {
+	    std::cout << "Processing " << files[b + i].string() << "\n";
+	    if (!sdata[i]) {
+		continue;
+	    }
+	    merge_fi_data<M>(fi_data, sdata[i].get());
+	    sdata[i].reset();
+	}
+    }
 
     return 0;
 }
 
-int
-parse_splice_fi_file(git_fi_data *fi_data, std::ifstream &infile)
+// Find where to split a fast-import stream into about nchunks pieces for
+// parsing.  Only the start of a record is a safe place to split, and data
+// payloads can contain anything, so this has to walk the stream from the
+// top - but it only looks at the start of each line, and steps over the
+// payloads using their "data <n>" lengths.  Returns the chunk boundaries,
+// starting with 0 and ending with the stream length.
+static std::vector<size_t>
+fi_split_records(std::string_view in, size_t nchunks)
 {
-    std::map<std::string, gitcmd_t> cmdmap;
-    cmdmap[std::string("alias")] = parse_alias;
-    cmdmap[std::string("blob")] = parse_blob;
-    cmdmap[std::string("cat-blob")] = parse_cat_blob;
-    cmdmap[std::string("checkpoint")] = parse_checkpoint;
-    cmdmap[std::string("commit ")] = parse_splice_commit;
-    cmdmap[std::string("done")] = parse_done;
-    cmdmap[std::string("feature")] = parse_feature;
-    cmdmap[std::string("get-mark")] = parse_get_mark;
-    cmdmap[std::string("ls")] = parse_ls;
-    cmdmap[std::string("option")] = parse_option;
-    cmdmap[std::string("progress")] = parse_progress;
-    cmdmap[std::string("reset")] = parse_reset;
-    cmdmap[std::string("tag")] = parse_tag;
-
-    size_t offset = infile.tellg();
-    std::string line;
-    std::map<std::string, gitcmd_t>::iterator c_it;
-    while (std::getline(infile, line)) {
-	// Skip empty lines
-	if (!line.length()) {
-	    offset = infile.tellg();
+    std::vector<size_t> splits;
+    splits.push_back(0);
+    size_t target = in.length() / nchunks;
+    size_t pos = 0;
+    while (pos < in.length()) {
+	size_t eol = in.find('\n', pos);
+	if (eol == std::string::npos) {
+	    break;
+	}
+	std::string_view line = in.substr(pos, eol - pos);
+	pos = eol + 1;
+	if (line.length() > 5 && line.compare(0, 5, "data ") == 0) {
+	    size_t len = 0;
+	    std::from_chars(line.data() + 5, line.data() + line.length(), len);
+	    pos = std::min(pos + len, in.length());
 	    continue;
 	}
-
-	gitcmd_t gc = gitit_find_cmd(line, cmdmap);
-	if (!gc) {
-	    //std::cerr << "Unsupported command!\n";
-	    offset = infile.tellg();
+	size_t lstart = eol - line.length();
+	if (lstart - splits.back() < target) {
 	    continue;
 	}
-
-	// If we found a command, process it
-	//std::cout << "line: " << line << "\n";
-	// some commands have data on the command line - reset seek so the
-	// callback can process it
-	infile.seekg(offset);
-	(*gc)(fi_data, infile);
-	offset = infile.tellg();
+	if (!line.compare(0, 7, "commit ") || !line.compare(0, 4, "blob") ||
+		!line.compare(0, 4, "tag ") || !line.compare(0, 6, "reset ")) {
+	    splits.push_back(lstart);
+	}
     }
+    splits.push_back(in.length());
+    return splits;
+}
 
+// Parse the main input.  A large mapped input is split into chunks at record
+// boundaries, which are parsed independently on worker threads into staging
+// data (see git_fi_data::staging.)  The chunks are then merged in stream
+// order, which assigns marks and resolves references exactly as parsing the
+// whole stream in one go would.
+#define FI_MIN_CHUNK (1024*1024)
 
+static int
+parse_main_fi_file(git_fi_data *fi_data, git_fi_reader &infile)
+{
+    std::string_view in = infile.view(0, std::string::npos);
+    size_t nchunks = std::min((size_t)fi_data->threads * 4, in.length() / FI_MIN_CHUNK);
+    if (!infile.mapped() || fi_data->threads < 2 || nchunks < 2) {
+	return parse_main_fi_range(fi_data, infile);
+    }
+
+    std::vector<size_t> splits;
+    {
+	fi_span span("split input");
+	splits = fi_split_records(in, nchunks);
+    }
+    nchunks = splits.size() - 1;
+    std::vector<std::unique_ptr<git_fi_data>> sdata(nchunks);
+    fi_parallel_for(nchunks, fi_data->threads, [&](size_t i) {
+	fi_span span("parse chunk", std::string("bytes ") + std::to_string(splits[i]) + std::string("-") + std::to_string(splits[i+1]));
+	git_fi_reader cfile;
+	if (cfile.open_range(infile, splits[i], splits[i+1])) {
+	    return;
+	}
+	std::unique_ptr<git_fi_data> st(new git_fi_data);
+	st->staging = true;
+	parse_main_fi_range(st.get(), cfile);
+	sdata[i] = std::move(st);
+    });
+
+    size_t bcnt = 0, ccnt = 0, tcnt = 0;
+    for (size_t i = 0; i < nchunks; i++) {
+	if (!sdata[i]) {
+	    std::cerr << "Could not parse input from offset " << splits[i] << "\n";
+	    return -1;
+	}
+	bcnt += sdata[i]->blobs.size();
+	ccnt += sdata[i]->commits.size();
+	tcnt += sdata[i]->tags.size();
+    }
+    fi_data->blobs.reserve(fi_data->blobs.size() + bcnt);
+    fi_data->commits.reserve(fi_data->commits.size() + ccnt);
+    fi_data->tags.reserve(fi_data->tags.size() + tcnt);
+
+    for (size_t i = 0; i < nchunks; i++) {
+	fi_span span("merge chunk");
+	merge_fi_data<fi_parse_normal>(fi_data, sdata[i].get());
+	sdata[i].reset();
+    }
     return 0;
 }
 
-int
-parse_replace_fi_file(git_fi_data *fi_data, std::ifstream &infile)
+// The output is written as a series of parts, each a run of records written
+// by write(out, i) for i in [0, count).
+struct fi_out_part {
+    size_t count;
+    std::function<void(git_fi_writer &, size_t)> write;
+};
+
+#define FI_WRITE_CHUNK 256
+
+// Write the parts out to path.  Given more than one thread and a regular
+// file to write to, chunks of records are written in parallel: a first pass
+// writes each chunk to a counter rather than the file, to find out exactly
+// how much output it produces.  Summing those sizes up gives every chunk its
+// place in the file, and the chunks are then written straight to their
+// places with positioned writes.  The result is the same as writing
+// everything out in order.  (Compressed output can only be written in
+// order, but the compressor may use the threads.)  nwritten is set to the
+// size of the output (before any compression.)
+static int
+write_fi_parts(std::vector<fi_out_part> &parts, const char *path, int nthreads, fi_compression comp, size_t &nwritten)
 {
-    std::map<std::string, gitcmd_t> cmdmap;
-    cmdmap[std::string("alias")] = parse_alias;
-    cmdmap[std::string("blob")] = parse_blob;
-    cmdmap[std::string("cat-blob")] = parse_cat_blob;
-    cmdmap[std::string("checkpoint")] = parse_checkpoint;
-    cmdmap[std::string("commit ")] = parse_replace_commit;
-    cmdmap[std::string("done")] = parse_done;
-    cmdmap[std::string("feature")] = parse_feature;
-    cmdmap[std::string("get-mark")] = parse_get_mark;
-    cmdmap[std::string("ls")] = parse_ls;
-    cmdmap[std::string("option")] = parse_option;
-    cmdmap[std::string("progress")] = parse_progress;
-    cmdmap[std::string("reset")] = parse_reset;
-    cmdmap[std::string("tag")] = parse_tag;
-
-    size_t offset = infile.tellg();
-    std::string line;
-    std::map<std::string, gitcmd_t>::iterator c_it;
-    while (std::getline(infile, line)) {
-	// Skip empty lines
-	if (!line.length()) {
-	    offset = infile.tellg();
-	    continue;
+    nwritten = 0;
+    size_t nrecords = 0;
+    for (size_t p = 0; p < parts.size(); p++) {
+	nrecords += parts[p].count;
+    }
+    int ofd = -1;
+    if (std::string_view(path) != std::string_view("-")) {
+	ofd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (ofd < 0) {
+	    std::cerr << "Could not open output file: " << path << "\n";
+	    return -1;
+	}
+    }
+    struct stat sb;
+    if (nthreads < 2 || comp != fi_compress_none || ofd < 0 || fstat(ofd, &sb) || !S_ISREG(sb.st_mode)) {
+	git_fi_writer ofile;
+	if (((ofd >= 0) ? ofile.open_fd(ofd, true) : ofile.open(path))) {
+	    return -1;
+	}
+	if (ofile.compress(comp, nthreads)) {
+	    return -1;
+	}
+	fi_span span("write output");
+	fi_meter.phase("writing", nrecords);
+	for (size_t p = 0; p < parts.size(); p++) {
+	    for (size_t i = 0; i < parts[p].count; i++) {
+		parts[p].write(ofile, i);
+		if (!((i + 1) % FI_PROGRESS_CMDS)) {
+		    fi_meter.add(FI_PROGRESS_CMDS);
+		}
+	    }
+	    fi_meter.add(parts[p].count % FI_PROGRESS_CMDS);
 	}
+	int ret = ofile.close();
+	nwritten = ofile.written();
+	return ret;
+    }
 
-	gitcmd_t gc = gitit_find_cmd(line, cmdmap);
-	if (!gc) {
-	    //std::cerr << "Unsupported command!\n";
-	    offset = infile.tellg();
-	    continue;
+    struct out_chunk {
+	size_t part;
+	size_t start;
+	size_t end;
+	size_t size;
+	off_t offset;
+    };
+    std::vector<out_chunk> chunks;
+    for (size_t p = 0; p < parts.size(); p++) {
+	for (size_t i = 0; i < parts[p].count; i += FI_WRITE_CHUNK) {
+	    chunks.push_back({p, i, std::min(i + FI_WRITE_CHUNK, parts[p].count), 0, 0});
 	}
+    }
 
-	// If we found a command, process it
-	//std::cout << "line: " << line << "\n";
-	// some commands have data on the command line - reset seek so the
-	// callback can process it
-	infile.seekg(offset);
-	(*gc)(fi_data, infile);
-	offset = infile.tellg();
+    // Find out how big everything is
+    fi_meter.phase("sizing output", nrecords);
+    fi_parallel_for(chunks.size(), nthreads, [&](size_t k) {
+	out_chunk &ck = chunks[k];
+	fi_span span("count chunk");
+	git_fi_writer cfile;
+	cfile.open_count();
+	for (size_t i = ck.start; i < ck.end; i++) {
+	    parts[ck.part].write(cfile, i);
+	}
+	ck.size = cfile.written();
+	fi_meter.add(ck.end - ck.start);
+    });
+    off_t total = 0;
+    for (size_t k = 0; k < chunks.size(); k++) {
+	chunks[k].offset = total;
+	total += chunks[k].size;
     }
 
-    return 0;
+    // Set aside the space up front (if the filesystem can), rather than
+    // having it grown piecemeal by writers all over the file
+    if (fallocate(ofd, 0, 0, total) && ftruncate(ofd, total)) {
+	std::cerr << "Could not size output file: " << path << "\n";
+	::close(ofd);
+	return -1;
+    }
+
+    std::atomic<bool> failed(false);
+    fi_meter.phase("writing", nrecords);
+    fi_parallel_for(chunks.size(), nthreads, [&](size_t k) {
+	out_chunk &ck = chunks[k];
+	fi_span span("write chunk", std::string("offset ") + std::to_string(ck.offset));
+	git_fi_writer ofile;
+	if (ofile.open_at(ofd, ck.offset)) {
+	    failed = true;
+	    return;
+	}
+	for (size_t i = ck.start; i < ck.end; i++) {
+	    parts[ck.part].write(ofile, i);
+	}
+	fi_meter.add(ck.end - ck.start);
+	if (ofile.close()) {
+	    failed = true;
+	} else if (ofile.written() != ck.size) {
+	    std::cerr << "Output at offset " << ck.offset << " is " << ofile.written() << " bytes, expected " << ck.size << "\n";
+	    failed = true;
+	}
+    });
+
+    if (::close(ofd)) {
+	failed = true;
+    }
+    nwritten = total;
+    return (failed) ? -1 : 0;
 }
 
+// Paths of written records are dropped once there are more than
+// FI_STREAM_PATHS of them
+#define FI_STREAM_PATHS 65536
+
+// Single pass processing - each record is transformed and written out as
+// soon as it is parsed, and then dropped.  Only operations that need nothing
+// more than the current record (plus the mark/sha1 bookkeeping) can be done
+// this way.
 int
-parse_add_fi_file(git_fi_data *fi_data, std::ifstream &infile)
+stream_fi_file(git_fi_data *fi_data, git_fi_reader &infile, git_fi_writer &outfile)
 {
-    std::map<std::string, gitcmd_t> cmdmap;
-    cmdmap[std::string("alias")] = parse_alias;
-    cmdmap[std::string("blob")] = parse_blob;
-    cmdmap[std::string("cat-blob")] = parse_cat_blob;
-    cmdmap[std::string("checkpoint")] = parse_checkpoint;
-    cmdmap[std::string("commit ")] = parse_add_commit;
-    cmdmap[std::string("done")] = parse_done;
-    cmdmap[std::string("feature")] = parse_feature;
-    cmdmap[std::string("get-mark")] = parse_get_mark;
-    cmdmap[std::string("ls")] = parse_ls;
-    cmdmap[std::string("option")] = parse_option;
-    cmdmap[std::string("progress")] = parse_progress;
-    cmdmap[std::string("reset")] = parse_reset;
-    cmdmap[std::string("tag")] = parse_tag;
-
-    size_t offset = infile.tellg();
-    std::string line;
-    std::map<std::string, gitcmd_t>::iterator c_it;
-    while (std::getline(infile, line)) {
-	// Skip empty lines
-	if (!line.length()) {
-	    offset = infile.tellg();
-	    continue;
+    size_t last = infile.tell();
+    size_t ncmds = 0;
+    // Paths known before the input (the mode map's) are kept throughout
+    size_t npaths = fi_data->paths.size();
+    while (parse_fi_cmd<fi_parse_normal>(fi_data, infile)) {
+
+	// Write out whatever that command produced.  Blob contents are
+	// still in the input at this point and are copied through by
+	// write_blob.
+	for (size_t i = 0; i < fi_data->blobs.size(); i++) {
+	    if (write_blob(outfile, &fi_data->blobs[i], infile)) {
+		return -1;
+	    }
 	}
-
-	gitcmd_t gc = gitit_find_cmd(line, cmdmap);
-	if (!gc) {
-	    //std::cerr << "Unsupported command!\n";
-	    offset = infile.tellg();
-	    continue;
+	for (size_t i = 0; i < fi_data->commits.size(); i++) {
+	    git_commit_data *c = &fi_data->commits[i];
+	    parse_cvs_svn_info(c, c->commit_msg);
+	    commit_map_emails(c);
+	    commit_map_svn_committer(c);
+	    commit_map_blobs(c);
+	    commit_map_modes(c);
+	    write_commit(outfile, c, fi_data);
+	}
+	for (size_t i = 0; i < fi_data->tags.size(); i++) {
+	    write_tag(outfile, &fi_data->tags[i]);
+	}
+	fi_data->blobs.clear();
+	fi_data->commits.clear();
+	fi_data->tags.clear();
+	// Nothing refers to the text of the records just written any more
+	fi_data->strings.clear();
+	if (fi_data->paths.size() > npaths + FI_STREAM_PATHS) {
+	    fi_data->paths.truncate(npaths);
 	}
 
-	// If we found a command, process it
-	//std::cout << "line: " << line << "\n";
-	// some commands have data on the command line - reset seek so the
-	// callback can process it
-	infile.seekg(offset);
-	(*gc)(fi_data, infile);
-	offset = infile.tellg();
+	if (!(++ncmds % FI_PROGRESS_CMDS)) {
+	    size_t pos = infile.tell();
+	    fi_meter.add(pos - last);
+	    last = pos;
+	}
     }
-
+    fi_meter.add(infile.tell() - last);
 
     return 0;
 }
 
-
+// Print the --stats report, to stats_file if one was given
+static int
+write_stats(fi_stats &stats, const std::string &format, const std::string &stats_file)
+{
+    if (!stats_file.length()) {
+	stats.report(std::cerr, (format == std::string("json")));
+	return 0;
+    }
+    std::ofstream sfile(stats_file, std::ios::binary);
+    if (!sfile.good()) {
+	std::cerr << "Could not open stats file: " << stats_file << "\n";
+	return -1;
+    }
+    stats.report(sfile, (format == std::string("json")));
+    return 0;
+}
 
 int
 main(int argc, char *argv[])
@@ -243,6 +528,9 @@ main(int argc, char *argv[])
     bool wrap_commit_lines = false;
     bool trim_whitespace = false;
     bool list_empty = false;
+    bool stream_mode = false;
+    bool mem_report = false;
+    bool progress = false;
     std::string file_inserts;
     std::string blob_map;
     std::string mode_map;
@@ -259,7 +547,13 @@ main(int argc, char *argv[])
     std::string key_sha1_map;
     std::string children_file;
     std::string id_file;
+    std::string compress_type;
+    std::string stats_format;
+    std::string stats_file;
+    std::string trace_file;
+    fi_stats stats;
     int cwidth = 72;
+    int nthreads = std::max((int)std::thread::hardware_concurrency(), 1);
 
     // TODO - might be good do have a "validate" option that does the fast import and then
     // checks every commit saved from the old repo in the new one...
@@ -275,7 +569,7 @@ main(int argc, char *argv[])
 	    ("width", "Column wrapping width (if enabled)", cxxopts::value<int>(), "N")
 
 	    ("r,repo", "Original git repository path (must support running git log)", cxxopts::value<std::vector<std::string>>(), "path")
-	    ("n,collapse-notes", "Take any git-notes contents and append them to regular commit messages.  Requires --repo", cxxopts::value<bool>(collapse_notes))
+	    ("n,collapse-notes", "Take any git-notes contents and append them to regular commit messages.  Notes are read from the repository given with --repo, or from the notes commits in the input if there isn't one", cxxopts::value<bool>(collapse_notes))
 
 	    ("blob-map", "Specify sha1 list of blobs to replace with other blobs - format is sha1;sha1", cxxopts::value<std::vector<std::string>>(), "map_file")
 	    ("mode-map", "Specify mode to apply to paths - format is mode;path", cxxopts::value<std::vector<std::string>>(), "map_file")
@@ -303,7 +597,17 @@ main(int argc, char *argv[])
 	    ("key-branch-map", "msg&time -> branch map (needs sha1->key map)", cxxopts::value<std::vector<std::string>>(), "file")
 
 	    ("rebuild-ids", "Specify commits (revision number or SHA1) to rebuild.  Requires git-repo be set as well.  Needs --show-original-ids information in fast import file", cxxopts::value<std::vector<std::string>>(), "file")
-	    ("rebuild-ids-children", "File with output of \"git rev-list --children --all\" - needed for processing rebuild-ids", cxxopts::value<std::vector<std::string>>(), "file")
+	    ("rebuild-ids-children", "File with output of \"git rev-list --children --all\" - optional for processing rebuild-ids, since child commits are found from the input, but needed to find children the input doesn't have (e.g. if it is a partial export)", cxxopts::value<std::vector<std::string>>(), "file")
+
+	    ("stream", "Process the input in a single pass, writing each record as soon as it is read.  Input and output default to stdin and stdout (or \"-\").  Supports only the trim-whitespace, wrap-commit-lines, width, email-map, mode-map, blob-map and svn-accounts options.  Memory use grows only with the number of marks and SHA1s in the input.", cxxopts::value<bool>(stream_mode))
+
+	    ("j,threads", "Number of threads to use for parsing and output (defaults to the number of cores)", cxxopts::value<int>(), "N")
+	    ("stats", "Report the wall and CPU time, peak memory growth and number of commits and file operations changed by each phase of processing, along with the amount of data read and written.  Use --stats=json for JSON rather than a table.", cxxopts::value<std::string>(stats_format)->implicit_value("text"), "format")
+	    ("stats-file", "Write the --stats report to a file rather than to stderr", cxxopts::value<std::string>(stats_file), "file")
+	    ("mem-report", "Report the memory used by each of the main data structures (blobs, commits, text, paths and the various indexes and maps) at the point where their total is largest, to stderr", cxxopts::value<bool>(mem_report))
+	    ("progress", "Show what is being done, how far along it is, how fast it is going and an estimate of the time left, on stderr", cxxopts::value<bool>(progress))
+	    ("trace", "Record a timeline of the processing phases and of the work done on each thread to a file, as Chrome trace event JSON (viewable in Perfetto)", cxxopts::value<std::string>(trace_file), "file")
+	    ("compress", "Compress the output with gzip or zstd (or none).  Defaults to going by the output file's extension (.gz or .zst).  Compressed input is recognized automatically.", cxxopts::value<std::string>(compress_type), "type")
 
 	    ("h,help", "Print help")
 	    ;
@@ -418,6 +722,11 @@ main(int argc, char *argv[])
 	    cwidth = result["width"].as<int>();
 	}
 
+	if (result.count("threads"))
+	{
+	    nthreads = std::max(result["threads"].as<int>(), 1);
+	}
+
     }
     catch (const cxxopts::OptionException& e)
     {
@@ -425,31 +734,134 @@ main(int argc, char *argv[])
 	return -1;
     }
 
-    if (collapse_notes && !repo_path.length()) {
-	std::cerr << "Cannot collapse notes into commit messages without knowing the path\nto the repository - aborting.  (It is necessary to run git log to\ncapture the message information, and for that we need the original\nrepository in addition to the fast-import file.)\n\nTo specify a repo folder, use the -r option.  Currently the folder must be in the working directory.\n";
+    if (stats_file.length() && !stats_format.length()) {
+	stats_format = std::string("text");
+    }
+    if (stats_format.length() && stats_format != std::string("text") && stats_format != std::string("json")) {
+	std::cerr << "Unknown stats format: " << stats_format << "\n";
 	return -1;
     }
 
+    if (trace_file.length() && fi_tracer.open(trace_file)) {
+	return -1;
+    }
+    stats.count_changes = (stats_format.length() > 0);
+    if (progress) {
+	fi_meter.start();
+    }
+    stats.track_memory = mem_report;
+
     if (id_file.length() && !repo_path.length()) {
 	std::cerr << "Need Git repository path for CVS id list processing!\n";
 	return -1;
     }
 
+    if (stream_mode) {
+	if (collapse_notes || splice_commits || replace_commits || add_commits || list_empty ||
+		no_blobs || no_commits || no_tags || repo_path.length() || file_inserts.length() ||
+		svn_rev_map.length() || svn_branch_map.length() || correct_branches.length() ||
+		svn_tags.length() || remove_commits.length() || key_sha1_map.length() ||
+		key_account_map.length() || key_branch_map.length() || id_file.length()) {
+	    std::cerr << "--stream supports only the trim-whitespace, wrap-commit-lines, width, email-map, mode-map, blob-map and svn-accounts options\n";
+	    return -1;
+	}
+	if (argc > 3) {
+	    std::cout << "repowork --stream [OPTION...] [<input_file>|-] [<output_file>|-]\n";
+	    return -1;
+	}
+	std::string ifile = (argc > 1) ? std::string(argv[1]) : std::string("-");
+	std::string ofile = (argc > 2) ? std::string(argv[2]) : std::string("-");
+
+	// If the fast-import data is going to stdout, everything that would
+	// normally be printed there has to go to stderr instead.
+	fi_compression ocomp;
+	if (fi_output_compression(ocomp, ofile, compress_type)) {
+	    return -1;
+	}
+	git_fi_writer outfile;
+	if (outfile.open(ofile.c_str()) || outfile.compress(ocomp, nthreads)) {
+	    return -1;
+	}
+	std::streambuf *stdout_buf = std::cout.rdbuf();
+	if (ofile == std::string("-")) {
+	    std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
+	git_fi_reader infile;
+	if (infile.open(ifile.c_str())) {
+	    std::cout.rdbuf(stdout_buf);
+	    return -1;
+	}
+
+	fi_data.stream_mode = true;
+	fi_data.wrap_width = cwidth;
+	fi_data.wrap_commit_lines = wrap_commit_lines;
+	fi_data.trim_whitespace = trim_whitespace;
+	if (email_map.length()) {
+	    read_email_map(&fi_data, email_map);
+	}
+	if (svn_accounts.length()) {
+	    read_svn_committer_map(&fi_data, svn_accounts);
+	}
+	if (blob_map.length()) {
+	    read_blob_map(&fi_data, blob_map);
+	}
+	if (mode_map.length()) {
+	    read_mode_map(&fi_data, mode_map);
+	}
+
+	if (stats_format.length() || trace_file.length() || mem_report) {
+	    stats.start(&fi_data);
+	}
+	fi_meter.phase("streaming", (infile.mapped()) ? infile.view(0, std::string::npos).length() : 0, true);
+	int ret = stream_fi_file(&fi_data, infile, outfile);
+	outfile << "progress Done.\n";
+	if (outfile.close()) {
+	    ret = -1;
+	}
+	fi_meter.stop();
+	stats.phase("stream", &fi_data, outfile.written());
+	std::cout.rdbuf(stdout_buf);
+	if (stats_format.length() && write_stats(stats, stats_format, stats_file)) {
+	    ret = -1;
+	}
+	if (mem_report) {
+	    stats.mem_report(std::cerr);
+	}
+	if (fi_tracer.close()) {
+	    ret = -1;
+	}
+	return ret;
+    }
+
     if (argc != 3) {
 	std::cout << "repowork [OPTION...] <input_file> <output_file>\n";
 	return -1;
     }
-    std::ifstream infile(argv[1], std::ifstream::binary);
-    if (!infile.good()) {
+    fi_compression ocomp;
+    if (fi_output_compression(ocomp, std::string(argv[2]), compress_type)) {
+	return -1;
+    }
+    git_fi_reader infile;
+    if (infile.open(argv[1])) {
 	return -1;
     }
 
-    parse_fi_file(&fi_data, infile);
+    fi_data.threads = nthreads;
+    if (stats_format.length() || trace_file.length() || mem_report) {
+	stats.start(&fi_data);
+    }
+    fi_meter.phase("parsing", (infile.mapped()) ? infile.view(0, std::string::npos).length() : 0, true);
+    parse_main_fi_file(&fi_data, infile);
+    fi_meter.phase("processing", 0);
+    stats.input_size = (infile.mapped()) ? infile.view(0, std::string::npos).length() : infile.tell();
+    stats.phase("parse", &fi_data, stats.input_size);
 
     // The subsequent steps, if invoked, may need svn_id set.
     for (size_t i = 0; i < fi_data.commits.size(); i++) {
 	parse_cvs_svn_info(&fi_data.commits[i], fi_data.commits[i].commit_msg);
     }
+    stats.phase("svn-cvs-info", &fi_data);
 
     // TODO - there are quite a few more conditions that should trigger this failure...
     if ((replace_commits || splice_commits || add_commits) && !fi_data.have_sha1s) {
@@ -468,13 +880,17 @@ main(int argc, char *argv[])
 	// (blobs will have to be taken care of later by git gc).
 	fi_data.write_notes = false;
 
-	// Reset the input stream
-	infile.clear();
-	infile.seekg(0, std::ios::beg);
-
-	// Handle the notes
-	git_unpack_notes(&fi_data, repo_path);
+	// Handle the notes - from the repository if we have it, otherwise
+	// from the notes commits in the input
+	if (repo_path.length()) {
+	    fi_meter.phase("reading notes", fi_data.commits.size());
+	    git_unpack_notes(&fi_data, repo_path);
+	} else {
+	    git_stream_notes(&fi_data, infile);
+	}
 	git_parse_notes(&fi_data);
+	fi_meter.phase("processing", 0);
+	stats.phase("collapse-notes", &fi_data);
     }
 
     if (key_sha1_map.length()) {
@@ -496,25 +912,26 @@ main(int argc, char *argv[])
 	}
 	read_key_cvsbranch_map(&fi_data, key_branch_map);
     }
+    if (key_sha1_map.length()) {
+	stats.phase("key-maps", &fi_data);
+    }
 
     if (email_map.length()) {
-	// Reset the input stream
-	infile.clear();
-	infile.seekg(0, std::ios::beg);
-
 	// Handle the notes
 	git_map_emails(&fi_data, email_map);
+	stats.phase("email-map", &fi_data);
     }
 
     if (svn_accounts.length()) {
 	// Handle the svn committers
 	git_map_svn_committers(&fi_data, svn_accounts);
+	stats.phase("svn-accounts", &fi_data);
     }
 
     if (list_empty) {
 	for (size_t i = 0; i < fi_data.commits.size(); i++) {
 	    if (fi_data.commits[i].commit_msg.length() && !fi_data.commits[i].fileops.size()) {
-		if (fi_data.commits[i].id.sha1.length()) {
+		if (!fi_data.commits[i].id.sha1.is_null()) {
 		    std::cout << "Empty commit(" << fi_data.commits[i].id.sha1 << "): " << fi_data.commits[i].commit_msg << "\n";
 		} else {
 		    std::cout << "Empty commit: " << fi_data.commits[i].commit_msg << "\n";
@@ -526,16 +943,19 @@ main(int argc, char *argv[])
     if (id_file.length()) {
 	// Handle rebuild info
 	git_id_rebuild_commits(&fi_data, id_file, repo_path, children_file);
+	stats.phase("rebuild-ids", &fi_data);
     }
 
     if (remove_commits.length()) {
 	git_remove_commits(&fi_data, remove_commits);
+	stats.phase("remove-commits", &fi_data);
     }
 
     ////////////////////////////////////////////////////
     // Various note correction routines
     if (svn_rev_map.length()) {
 	git_update_svn_revs(&fi_data, svn_rev_map);
+	stats.phase("svn-revs", &fi_data);
     }
 
     if (svn_branch_map.length()) {
@@ -547,13 +967,14 @@ main(int argc, char *argv[])
     if (svn_tags.length()) {
 	git_set_tag_labels(&fi_data, svn_tags);
     }
+    if (svn_branch_map.length() || correct_branches.length() || svn_tags.length()) {
+	stats.phase("branch-labels", &fi_data);
+    }
 
     fi_data.wrap_width = cwidth;
     fi_data.wrap_commit_lines = wrap_commit_lines;
     fi_data.trim_whitespace = trim_whitespace;
 
-    infile.close();
-
 
     // If we have any replace commits, parse and overwrite.
     if (replace_commits) {
@@ -565,14 +986,9 @@ main(int argc, char *argv[])
 	if (!std::filesystem::exists(pip)) {
 	    std::cerr << "Warning - splices enabled but " << pip << " is not present on the filesystem.\n";
 	} else {
-	    for (const auto& de : std::filesystem::recursive_directory_iterator(pip)) {
-		std::cout << "Processing " << de.path().string() << "\n";
-		std::ifstream sfile(de.path(), std::ifstream::binary);
-		fi_data.replace_sha1 = de.path().filename().string();
-		int ret = parse_replace_fi_file(&fi_data, sfile);
-		sfile.close();
-	    }
+	    parse_fi_dir<fi_parse_replace>(&fi_data, pip);
 	}
+	stats.phase("replace-commits", &fi_data);
     }
 
     // If we have any additional commits, parse and insert them.
@@ -585,13 +1001,9 @@ main(int argc, char *argv[])
 	if (!std::filesystem::exists(pip)) {
 	    std::cerr << "Warning - adds enabled but " << pip << " is not present on the filesystem.\n";
 	} else {
-	    for (const auto& de : std::filesystem::recursive_directory_iterator(pip)) {
-		std::cout << "Processing " << de.path().string() << "\n";
-		std::ifstream sfile(de.path(), std::ifstream::binary);
-		int ret = parse_add_fi_file(&fi_data, sfile);
-		sfile.close();
-	    }
+	    parse_fi_dir<fi_parse_add>(&fi_data, pip);
 	}
+	stats.phase("add-commits", &fi_data);
     }
 
     // If we have any splice commits, parse and insert them.  (Note - this comes last, for
@@ -605,69 +1017,120 @@ main(int argc, char *argv[])
 	if (!std::filesystem::exists(pip)) {
 	    std::cerr << "Warning - splices enabled but " << pip << " is not present on the filesystem.\n";
 	} else {
-	    for (const auto& de : std::filesystem::recursive_directory_iterator(pip)) {
-		std::cout << "Processing " << de.path().string() << "\n";
-		std::ifstream sfile(de.path(), std::ifstream::binary);
-		int ret = parse_splice_fi_file(&fi_data, sfile);
-		sfile.close();
-	    }
+	    parse_fi_dir<fi_parse_splice>(&fi_data, pip);
+	    git_link_splices(&fi_data);
 	}
+	stats.phase("splice-commits", &fi_data);
     }
 
     // The previous steps all dealt with the commit structure.  Now, if supplied, delve
     // into the blob contents of the trees
     if (blob_map.length()) {
 	git_map_blobs(&fi_data, blob_map);
+	stats.phase("blob-map", &fi_data);
     }
 
     if (mode_map.length()) {
 	git_map_modes(&fi_data, mode_map);
+	stats.phase("mode-map", &fi_data);
     }
 
     if (file_inserts.length()) {
 	git_file_inserts(&fi_data, file_inserts);
+	stats.phase("file-inserts", &fi_data);
+    }
+
+    // Everything is settled - work out the final commit messages
+    if (!no_commits) {
+	fi_meter.phase("rendering messages", fi_data.commits.size() + fi_data.splice_commits.size());
+	git_render_commit_msgs(&fi_data);
+	stats.phase("render-msgs", &fi_data);
+    }
+
+    // Anything to report about the commits is reported up front, in order,
+    // since the commits themselves may not be written in order
+    if (!no_commits) {
+	for (size_t i = 0; i < fi_data.commits.size(); i++) {
+	    write_commit_notices(&fi_data.commits[i], &fi_data);
+	}
     }
 
-    std::ifstream ifile(argv[1], std::ifstream::binary);
-    std::ofstream ofile(argv[2], std::ios::out | std::ios::binary);
+    // Blob contents of inputs that couldn't be mapped (compressed ones) are
+    // read out of a second pass over the input, going forward as the
+    // blobs are written in order
+    int wthreads = fi_data.threads;
+    if (!infile.mapped() && infile.rewindable()) {
+	if (infile.rewind()) {
+	    std::cerr << "Could not reread input file: " << argv[1] << "\n";
+	    return -1;
+	}
+	wthreads = 1;
+    }
+
+    std::vector<fi_out_part> parts;
     if (!no_blobs) {
-	ofile << "progress Writing blobs...\n";
-	for (size_t i = 0; i < fi_data.blobs.size(); i++) {
-	    write_blob(ofile, &fi_data.blobs[i], ifile);
+	parts.push_back({1, [&](git_fi_writer &o, size_t) {
+	    o << "progress Writing blobs...\n";
+	}});
+	parts.push_back({fi_data.blobs.size(), [&](git_fi_writer &o, size_t i) {
+	    write_blob(o, &fi_data.blobs[i], infile);
 	    if ( !(i % 1000) ) {
-		ofile << "progress blob " << i << " of " << fi_data.blobs.size() << "\n";
+		o << "progress blob " << i << " of " << fi_data.blobs.size() << "\n";
 	    }
-	}
+	}});
     }
     if (!no_commits) {
-	ofile << "progress Writing commits...\n";
-	for (size_t i = 0; i < fi_data.commits.size(); i++) {
-	    write_commit(ofile, &fi_data.commits[i], &fi_data, ifile);
+	parts.push_back({1, [&](git_fi_writer &o, size_t) {
+	    o << "progress Writing commits...\n";
+	}});
+	parts.push_back({fi_data.commits.size(), [&](git_fi_writer &o, size_t i) {
+	    write_commit_quiet(o, &fi_data.commits[i], &fi_data);
 	    if ( !(i % 1000) ) {
-		ofile << "progress commit " << i << " of " << fi_data.commits.size() << "\n";
+		o << "progress commit " << i << " of " << fi_data.commits.size() << "\n";
 	    }
-	}
+	}});
     }
     if (!no_tags) {
-	ofile << "progress Writing tags...\n";
-	for (size_t i = 0; i < fi_data.tags.size(); i++) {
-	    write_tag(ofile, &fi_data.tags[i], ifile);
-	}
+	parts.push_back({1, [&](git_fi_writer &o, size_t) {
+	    o << "progress Writing tags...\n";
+	}});
+	parts.push_back({fi_data.tags.size(), [&](git_fi_writer &o, size_t i) {
+	    write_tag(o, &fi_data.tags[i]);
+	}});
     }
-    ofile << "progress Done.\n";
+    parts.push_back({1, [&](git_fi_writer &o, size_t) {
+	o << "progress Done.\n";
+    }});
 
-    ifile.close();
-    ofile.close();
+    size_t nwritten = 0;
+    int ret = write_fi_parts(parts, argv[2], wthreads, ocomp, nwritten);
+    infile.close();
+    fi_meter.stop();
+    if (ret) {
+	return -1;
+    }
+    stats.phase("write", &fi_data, nwritten);
 
     std::cout << "Git fast-import file is generated:  " << argv[2] << "\n\n";
     std::cout << "Note that when imported, compression and packing will be suboptimal by default.\n";
     std::cout << "Some possible steps to take:\n";
     std::cout << "  mkdir git_repo && cd git_repo && git init\n";
-    std::cout << "  cat ../" << argv[2] << " | git fast-import\n";
+    const char *cat = (ocomp == fi_compress_gzip) ? "zcat" : (ocomp == fi_compress_zstd) ? "zstdcat" : "cat";
+    std::cout << "  " << cat << " ../" << argv[2] << " | git fast-import\n";
     std::cout << "  git gc --aggressive\n";
     std::cout << "  git reflog expire --expire-unreachable=now --all\n";
     std::cout << "  git gc --prune=now\n";
 
+    if (stats_format.length() && write_stats(stats, stats_format, stats_file)) {
+	return -1;
+    }
+    if (mem_report) {
+	stats.mem_report(std::cerr);
+    }
+    if (fi_tracer.close()) {
+	return -1;
+    }
+
     return 0;
 }
 
@@ -11,15 +11,28 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
-#include <regex>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #ifndef REPOWORK_H
 #define REPOWORK_H
@@ -32,12 +45,671 @@
  * string - used primarily to find commands */
 #define ficmp(_s1, _s2) _s1.compare(0, _s2.size(), _s2) && _s1.size() >= _s2.size()
 
+/* Drop a command prefix from a line (lines shorter than the prefix come
+ * back empty rather than going out of range) */
+inline std::string_view
+fi_strip(std::string_view line, size_t n)
+{
+    return line.substr(std::min(n, line.size()));
+}
+
+/* Numerical fields in the stream are read straight out of the line views -
+ * this is the std::stol equivalent for a std::string_view */
+inline long
+fi_stol(std::string_view str)
+{
+    long val = 0;
+    std::from_chars_result r = std::from_chars(str.data(), str.data() + str.size(), val);
+    if (r.ec != std::errc()) {
+	std::cerr << "Invalid numerical value: " << str << "\n";
+	exit(EXIT_FAILURE);
+    }
+    return val;
+}
+
+/* Timeline of the run for --trace.  Spans of work are recorded against the
+ * thread that did them and written out as Chrome trace event JSON when the
+ * trace is closed.  Threads are identified by their slot in the parallel
+ * loop running them (0 for the main thread), so each worker position gets
+ * one track no matter how many times the workers are started up.  With no
+ * trace open, a span costs a single flag check. */
+extern thread_local int fi_thread_slot;
+
+class fi_trace {
+    public:
+	int open(const std::string &path);
+	// Write out the trace
+	int close();
+	bool enabled() const { return on; }
+
+	// Microseconds from the start of the trace
+	uint64_t us(std::chrono::steady_clock::time_point t) const;
+	uint64_t now() const { return us(std::chrono::steady_clock::now()); }
+	void add(const char *name, uint64_t start, uint64_t end, const std::string &detail);
+
+    private:
+	struct trace_event {
+	    const char *name;
+	    std::string detail;
+	    uint64_t ts;
+	    uint64_t dur;
+	    int tid;
+	};
+	bool on = false;
+	std::string ofile;
+	std::chrono::steady_clock::time_point t0;
+	std::mutex events_lock;
+	std::vector<trace_event> events;
+};
+
+extern fi_trace fi_tracer;
+
+/* Record the lifetime of a fi_span as a span of work named name (which must
+ * be a string literal or otherwise outlive the trace.) */
+class fi_span {
+    public:
+	fi_span(const char *n) {
+	    if (fi_tracer.enabled()) {
+		name = n;
+		start = fi_tracer.now();
+	    }
+	}
+	fi_span(const char *n, const std::string &d) : fi_span(n) {
+	    if (name)
+		detail = d;
+	}
+	~fi_span() {
+	    if (name)
+		fi_tracer.add(name, start, fi_tracer.now(), detail);
+	}
+
+    private:
+	const char *name = NULL;
+	uint64_t start = 0;
+	std::string detail;
+};
+
+/* Progress display on stderr for --progress.  The current phase is set with
+ * phase(), and the code doing the work reports what it gets through with
+ * add() - a relaxed atomic add, which is best done in batches from threaded
+ * loops.  A ticker thread works out rates and ETAs from the counts and keeps
+ * the display up to date, so none of that slows down the work itself.  With
+ * no display started, add() is a single flag check. */
+class fi_progress {
+    public:
+	~fi_progress();
+
+	void start();
+	void stop();
+	bool enabled() const { return on; }
+
+	// Start a phase with total work items to do (or total bytes, if
+	// bytes is set).  A total of 0 means the amount isn't known.
+	void phase(const char *name, size_t total, bool bytes = false);
+	void add(size_t n) {
+	    if (on)
+		done.fetch_add(n, std::memory_order_relaxed);
+	}
+
+    private:
+	void run();
+	void show(int64_t now);
+
+	bool on = false;
+	bool tty = false;
+	int64_t t_start = 0;
+	size_t last_len = 0;
+
+	std::atomic<const char *> pname{NULL};
+	std::atomic<size_t> done{0};
+	std::atomic<size_t> total{0};
+	std::atomic<bool> bytes{false};
+	std::atomic<int64_t> t_phase{0};
+
+	std::thread ticker;
+	std::mutex m;
+	std::condition_variable cv;
+	bool stopping = false;
+};
+
+extern fi_progress fi_meter;
+
+/* Run f(i) for each i in [0, n) using up to nthreads threads (the calling
+ * thread included.)  Items are handed out one at a time, so work of uneven
+ * size still spreads across the threads.  With one thread, or one item,
+ * everything runs in order on the calling thread. */
+template <typename F>
+void
+fi_parallel_for(size_t n, int nthreads, F &&f)
+{
+    size_t nt = std::min((size_t)std::max(nthreads, 1), n);
+    if (nt <= 1) {
+	for (size_t i = 0; i < n; i++)
+	    f(i);
+	return;
+    }
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+	size_t i;
+	while ((i = next++) < n)
+	    f(i);
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nt; t++) {
+	workers.emplace_back([&work, t]() {
+	    fi_thread_slot = (int)t;
+	    work();
+	});
+    }
+    work();
+    for (size_t t = 0; t < workers.size(); t++)
+	workers[t].join();
+}
+
+class git_fi_writer;
+
+/* Streaming compression and decompression, so fast-import streams can be
+ * kept compressed on disk.  gzip support needs zlib and zstd support needs
+ * libzstd - either may be missing from a given build. */
+enum fi_compression {
+    fi_compress_none = 0,
+    fi_compress_gzip,
+    fi_compress_zstd
+};
+
+// Identify compressed data from its first few bytes
+extern fi_compression fi_detect_compression(const char *magic, size_t len);
+// Work out how output to path should be compressed, from type (if set) or
+// the file extension.  Returns -1 if it can't be done.
+extern int fi_output_compression(fi_compression &c, const std::string &path, const std::string &type);
+
+class fi_decompressor {
+    public:
+	~fi_decompressor();
+
+	// Decompress type data read from fd.  The first plen bytes of the
+	// input have already been read from fd, into prefix.
+	int open(fi_compression type, int fd, const char *prefix, size_t plen);
+	void close();
+	// Decompress up to len bytes into dst.  Returns the number of bytes
+	// decompressed, 0 at the end of the input or -1 on error.
+	ssize_t read(char *dst, size_t len);
+
+    private:
+	bool refill();
+
+	fi_compression type = fi_compress_none;
+	void *ctx = NULL;
+	int ifd = -1;
+	std::vector<char> in;
+	size_t in_pos = 0;
+	size_t in_len = 0;
+	bool in_eof = false;
+	bool need_input = false;
+	bool finished = false;
+};
+
+class fi_compressor {
+    public:
+	~fi_compressor();
+
+	// Compress to fd.  zstd compression is spread across nthreads
+	// threads (if libzstd supports it.)
+	int open(fi_compression type, int fd, int nthreads);
+	// Finish the compressed stream
+	int close();
+	// Compress len bytes, writing whatever that produces to fd
+	bool write(const char *s, size_t len);
+
+    private:
+	bool run(const char *s, size_t len, bool end);
+	bool write_out(const char *s, size_t len);
+
+	fi_compression type = fi_compress_none;
+	void *ctx = NULL;
+	int ofd = -1;
+	std::vector<char> out;
+};
+
+/* Input source for fast-import streams.  Regular files are memory mapped and
+ * the parsers get lines and data payloads as views directly into the mapped
+ * file.  Pipes and other inputs that can't be mapped go through a buffered
+ * reader instead - views from those are only good until the next read.
+ * Compressed inputs are decompressed on their way into the buffer. */
+class git_fi_reader {
+    public:
+	~git_fi_reader();
+
+	int open(const char *path); // "-" reads stdin
+	int open_fd(int fd, bool owned);
+	// Read bytes [start, end) of a mapped input, sharing its mapping.
+	// Offsets are those of the full input.  src must stay open.
+	int open_range(const git_fi_reader &src, size_t start, size_t end);
+	void close();
+
+	// Current line (without the newline), leaving the position unchanged.
+	// Repeated peeks (and a getline following a peek) don't rescan.
+	bool peek_line(std::string_view &line);
+	// Current line, advancing past it
+	bool getline(std::string_view &line);
+	// Next n bytes of raw data (e.g. a data payload), advancing past them
+	std::string_view read(size_t n);
+	void skip(size_t n);
+	// Pass the next n bytes of input through to out, advancing past them.
+	// Returns the number of bytes copied.
+	size_t copy(git_fi_writer &out, size_t n);
+	// Pass n bytes of previously parsed input starting at offset through to
+	// out.  Unmapped inputs can only do this going forward - a rewound
+	// input can give back data in the order it was first parsed.  Returns
+	// the number of bytes copied.
+	size_t copy_range(git_fi_writer &out, size_t offset, size_t n);
+
+	// Absolute offset in the input stream
+	size_t tell() const { return (map) ? pos : boffset + pos; }
+
+	// Mapped inputs can give back previously parsed data (such as blob
+	// contents) by offset, so there is no need to keep copies around.
+	bool mapped() const { return map != NULL; }
+	std::string_view view(size_t offset, size_t len) const;
+
+	// Unmapped files (compressed ones) can't give back data by offset
+	// directly, but can be read over again from the start.
+	bool rewindable() const { return map != NULL || reopenable; }
+	int rewind();
+
+	// If set, blob contents are copied out as they are parsed rather
+	// than referenced by offset.  Always the case for inputs that can't
+	// be rewound, and for any input other than the main fast-import file.
+	bool copy_blobs = false;
+
+    private:
+	const char *data() const { return (map) ? map : buf.data(); }
+	void fill(size_t n);
+	int open_buffered();
+
+	int ifd = -1;
+	bool own_fd = false;
+	bool own_map = false;
+	const char *map = NULL;
+	size_t map_len = 0;
+
+	size_t pos = 0;
+	size_t line_pos = std::string::npos;
+	size_t line_len = std::string::npos;
+
+	// Buffered mode state
+	std::vector<char> buf;
+	size_t bend = 0;
+	size_t boffset = 0;
+	bool eof = false;
+	fi_decompressor *dec = NULL;
+	bool reopenable = false;
+};
+
+/* Output for fast-import streams.  Records are formatted straight into a
+ * large page aligned buffer - strings are copied in and integers converted
+ * in place, with none of the per-insertion overhead (sentries, locales,
+ * virtual calls) of a std::ostream - which goes out to a file descriptor
+ * only when it fills up or is explicitly flushed.  Bulk data (blob contents)
+ * is moved from the input descriptor to the output descriptor by the
+ * kernel, without a trip through user space.
+ *
+ * A writer can also be opened just to count what is written to it, to find
+ * out how much output the write routines will produce without producing it.
+ */
+class git_fi_writer {
+    public:
+	~git_fi_writer();
+
+	int open(const char *path); // "-" writes stdout
+	int open_fd(int fd, bool owned);
+	// Write to fd starting at offset, using positioned writes (several
+	// of these can write different parts of the same file at once.)
+	int open_at(int fd, off_t offset);
+	// Discard the output, only counting it
+	int open_count();
+	// Compress everything written from here on
+	int compress(fi_compression type, int nthreads);
+	// Returns -1 if anything failed to make it to the output
+	int close();
+
+	// Push everything buffered so far out to the descriptor
+	bool flush() { return flush_buf(); }
+
+	// Bytes written so far (before any compression), including any still
+	// in the buffer
+	size_t written() const { return nwritten + (size_t)(p - bstart); }
+
+	void write(const char *s, size_t n) {
+	    if (n <= (size_t)(bend - p)) {
+		memcpy(p, s, n);
+		p += n;
+		return;
+	    }
+	    write_long(s, n);
+	}
+
+	git_fi_writer &operator<<(std::string_view s) {
+	    write(s.data(), s.length());
+	    return *this;
+	}
+	git_fi_writer &operator<<(char c) {
+	    if (p == bend && (!bstart || !flush_buf()))
+		return *this;
+	    *p++ = c;
+	    return *this;
+	}
+	template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value, int>::type = 0>
+	git_fi_writer &operator<<(T v) {
+	    if (std::is_signed<T>::value && v < 0) {
+		put_num(0ULL - (unsigned long long)v, true);
+	    } else {
+		put_num((unsigned long long)v, false);
+	    }
+	    return *this;
+	}
+
+	// Move n bytes from infd to the output, reading from *offset (which
+	// is advanced) or from infd's current position if offset is NULL.
+	// Uses copy_file_range, sendfile or splice if the descriptors support
+	// them and falls back to read/write if not.  Returns the number of
+	// bytes copied.
+	size_t copy_from(int infd, off_t *offset, size_t n);
+
+    private:
+	void put_num(unsigned long long v, bool neg);
+	void write_long(const char *s, size_t n);
+	bool write_all(const char *s, size_t len);
+	bool flush_buf();
+	int open_buf(int fd, bool owned, size_t bsize);
+
+	int ofd = -1;
+	bool own_fd = false;
+	bool counting = false;
+	bool failed = false;
+	size_t nwritten = 0;
+
+	// Output buffer - [bstart, bend), filled up to p
+	char *bstart = NULL;
+	char *bend = NULL;
+	char *p = NULL;
+
+	// Positioned output state
+	bool positioned = false;
+	off_t woff = 0;
+
+	// Which copy method works for the current input
+	int copy_fd = -1;
+	int copy_method = 0;
+
+	fi_compressor *comp = NULL;
+};
+
+/* Command dispatch.  Each record type (and the top level stream) has a
+ * static table of line prefixes and the handlers that process them.  The
+ * table is bucketed by the first byte of each prefix when it is built at
+ * compile time, so finding the handler for a line only means comparing it
+ * against the few commands starting with the same character. */
+template <typename T>
+struct fi_cmd {
+    std::string_view prefix;
+    int (*func)(T *, git_fi_reader &) = NULL;
+};
+
+template <typename T, size_t N>
+class fi_cmd_table {
+    public:
+	typedef int (*func_t)(T *, git_fi_reader &);
+
+	constexpr fi_cmd_table(const fi_cmd<T> (&c)[N]) : cmds(), first() {
+	    // Counting sort on the first byte - commands sharing a first
+	    // byte stay in the order they were listed.
+	    for (size_t i = 0; i < N; i++)
+		first[(unsigned char)c[i].prefix[0] + 1]++;
+	    for (size_t i = 1; i < 257; i++)
+		first[i] += first[i - 1];
+	    size_t next[256] = {};
+	    for (size_t i = 0; i < 256; i++)
+		next[i] = first[i];
+	    for (size_t i = 0; i < N; i++)
+		cmds[next[(unsigned char)c[i].prefix[0]]++] = c[i];
+	}
+
+	func_t find(std::string_view line) const {
+	    if (!line.length())
+		return NULL;
+	    unsigned char c = line[0];
+	    for (size_t i = first[c]; i < first[c + 1]; i++) {
+		std::string_view p = cmds[i].prefix;
+		if (line.length() >= p.length() && line.compare(0, p.length(), p) == 0)
+		    return cmds[i].func;
+	    }
+	    return NULL;
+	}
+
+    private:
+	fi_cmd<T> cmds[N];
+	size_t first[257];
+};
+
+template <typename T, size_t N>
+constexpr fi_cmd_table<T, N>
+fi_cmd_table_make(const fi_cmd<T> (&c)[N])
+{
+    return fi_cmd_table<T, N>(c);
+}
+
+/* Process the lines of a single record (blob, commit, tag, reset) until one
+ * turns up that isn't part of it - that line is left in the input for the
+ * caller.  A handler returning a positive value ends the record early. */
+template <typename T, size_t N>
+void
+fi_parse_record(T *rec, git_fi_reader &infile, const fi_cmd_table<T, N> &cmds)
+{
+    std::string_view line;
+    while (infile.peek_line(line)) {
+	typename fi_cmd_table<T, N>::func_t cc = cmds.find(line);
+	if (!cc || (*cc)(rec, infile) > 0)
+	    return;
+    }
+}
+
+/* The same commit parser is used for the main input and the various
+ * auxiliary inputs, differing only in how the new commit is incorporated
+ * into the existing history. */
+enum fi_parse_mode { fi_parse_normal, fi_parse_splice, fi_parse_replace, fi_parse_add };
+
+/* Git object id - a SHA1 held as its 20 raw bytes rather than 40 hex
+ * characters.  Anything that isn't a full length hex SHA1 decodes to the
+ * null (all zero) id, which is never used as a lookup key. */
+class git_oid {
+    public:
+	unsigned char b[20] = {0};
+
+	git_oid() {}
+	explicit git_oid(std::string_view hex) { from_hex(hex); }
+
+	bool from_hex(std::string_view hex) {
+	    // Indexed by character - value of a hex digit, or -1
+	    static constexpr struct hextab {
+		signed char v[256];
+		constexpr hextab() : v() {
+		    for (int i = 0; i < 256; i++) v[i] = -1;
+		    for (int i = 0; i < 10; i++) v['0' + i] = i;
+		    for (int i = 0; i < 6; i++) v['a' + i] = v['A' + i] = 10 + i;
+		}
+	    } tab;
+	    if (hex.length() == 40) {
+		int bad = 0;
+		for (int i = 0; i < 20; i++) {
+		    int h = tab.v[(unsigned char)hex[2*i]];
+		    int l = tab.v[(unsigned char)hex[2*i+1]];
+		    bad |= h | l;
+		    b[i] = (unsigned char)((h << 4) | l);
+		}
+		if (bad >= 0)
+		    return true;
+	    }
+	    memset(b, 0, sizeof(b));
+	    return false;
+	}
+
+	void to_hex(char *out) const {
+	    static const char digits[] = "0123456789abcdef";
+	    for (int i = 0; i < 20; i++) {
+		out[2*i] = digits[b[i] >> 4];
+		out[2*i+1] = digits[b[i] & 0xf];
+	    }
+	}
+	std::string hex() const {
+	    std::string s(40, '0');
+	    to_hex(&s[0]);
+	    return s;
+	}
+
+	bool is_null() const {
+	    static const unsigned char z[20] = {0};
+	    return !memcmp(b, z, sizeof(b));
+	}
+	bool operator==(const git_oid &o) const { return !memcmp(b, o.b, sizeof(b)); }
+	bool operator!=(const git_oid &o) const { return !(*this == o); }
+};
+
+// (Used for notices and messages.  Records without an original id have
+// always shown up in those with an empty id, so a null id prints nothing.)
+inline std::ostream &
+operator<<(std::ostream &os, const git_oid &o)
+{
+    if (o.is_null())
+	return os;
+    char h[40];
+    o.to_hex(h);
+    return os.write(h, 40);
+}
+
+inline git_fi_writer &
+operator<<(git_fi_writer &w, const git_oid &o)
+{
+    char h[40];
+    o.to_hex(h);
+    w.write(h, 40);
+    return w;
+}
+
+/* Real SHA1s are uniformly distributed, but ids made up by other tools (or
+ * for testing) often aren't - mix all of the bytes so they don't pile up in
+ * one corner of the hash table. */
+struct git_oid_hash {
+    size_t operator()(const git_oid &o) const {
+	uint64_t h[3] = {0, 0, 0};
+	memcpy(h, o.b, sizeof(o.b));
+	uint64_t x = h[0] ^ (h[1] * 0x9e3779b97f4a7c15ULL) ^ (h[2] * 0xc2b2ae3d27d4eb4fULL);
+	x ^= x >> 32;
+	x *= 0xd6e8feb86659fd93ULL;
+	x ^= x >> 32;
+	return (size_t)x;
+    }
+};
+
+/* Heap memory held by a value beyond its own size (for --mem-report) -
+ * strings too long to be stored in place have a buffer of their own. */
+inline size_t
+fi_heap_size(const std::string &s)
+{
+    const char *b = (const char *)&s;
+    if (s.data() >= b && s.data() < b + sizeof(s))
+	return 0;
+    return s.capacity() + 1;
+}
+template <typename T>
+inline size_t
+fi_heap_size(const T &)
+{
+    return 0;
+}
+
+/* Open addressing (linear probing) hash table for the id lookups, which
+ * can hold millions of entries - one flat array rather than a tree node
+ * allocation per entry.  Entries can be added and overwritten but not
+ * removed.  Lookups never insert, unlike std::map's operator[]. */
+template <typename K, typename V, typename H = std::hash<K>>
+class fi_hashmap {
+    public:
+	V *find(const K &k) {
+	    if (!count)
+		return NULL;
+	    size_t mask = slots.size() - 1;
+	    for (size_t i = H()(k) & mask; slots[i].used; i = (i + 1) & mask) {
+		if (slots[i].key == k)
+		    return &slots[i].val;
+	    }
+	    return NULL;
+	}
+	const V *find(const K &k) const {
+	    return const_cast<fi_hashmap *>(this)->find(k);
+	}
+
+	// Set k's value, adding it if not already present
+	V &insert(const K &k, const V &v) {
+	    if ((count + 1) * 4 > slots.size() * 3)
+		rehash((slots.size()) ? slots.size() * 2 : 64);
+	    size_t mask = slots.size() - 1;
+	    size_t i = H()(k) & mask;
+	    while (slots[i].used && !(slots[i].key == k))
+		i = (i + 1) & mask;
+	    if (!slots[i].used) {
+		slots[i].used = true;
+		slots[i].key = k;
+		count++;
+	    }
+	    slots[i].val = v;
+	    return slots[i].val;
+	}
+
+	size_t size() const { return count; }
+	void clear() { slots.clear(); count = 0; }
+
+	// Bytes allocated, including any held by the keys and values
+	size_t mem_size() const {
+	    size_t m = slots.capacity() * sizeof(slot);
+	    for (size_t i = 0; i < slots.size(); i++) {
+		if (slots[i].used)
+		    m += fi_heap_size(slots[i].key) + fi_heap_size(slots[i].val);
+	    }
+	    return m;
+	}
+
+    private:
+	struct slot {
+	    K key = K();
+	    V val = V();
+	    bool used = false;
+	};
+
+	void rehash(size_t nsize) {
+	    std::vector<slot> old;
+	    old.swap(slots);
+	    slots.resize(nsize);
+	    size_t mask = nsize - 1;
+	    for (size_t j = 0; j < old.size(); j++) {
+		if (!old[j].used)
+		    continue;
+		size_t i = H()(old[j].key) & mask;
+		while (slots[i].used)
+		    i = (i + 1) & mask;
+		slots[i] = std::move(old[j]);
+	    }
+	}
+
+	std::vector<slot> slots;
+	size_t count = 0;
+};
+
 class git_commitish {
     public:
 	long index = -1;  // all commits must have an index into the master commit vector
 	long mark  = -1;  // globally unique numerical identifier
-	std::string sha1 = std::string(); // Original sha1 or part thereof, if available.  If the commit is modified this string should be invalidated.
-	std::string ref = std::string(); //  branch reference or other Git reference
+	git_oid sha1; // Original sha1, if available (null if not.)  If the commit is modified this should be invalidated.
 
 	bool operator==(const git_commitish &o) const {
 	    if (index == o.index) return true;
@@ -47,35 +719,348 @@ class git_commitish {
 	}
 };
 
+/* Reverse edges of the commit graph - for each commit (by index) the commits
+ * naming it as their from or as one of their merges.  Edges are recorded as
+ * commits are parsed, and whenever a reference is changed later on.  Lookups
+ * use a compressed sparse row layout (one offset per commit and one flat
+ * array of children), which is brought up to date with any newly recorded
+ * edges when needed.  Nothing is ever taken out, so a listed child may no
+ * longer refer to the commit - callers need to check.
+ *
+ * Code changing references one at a time while it looks them up (splicing,
+ * removing commits) uses link rather than add - linked edges are visible to
+ * lookups right away without the whole layout being rebuilt for each one,
+ * and are folded into it the next time it is rebuilt anyway. */
+class git_child_index {
+    public:
+	// Children in the row itself, followed by any linked since
+	struct range {
+	    struct iterator {
+		const long *p;
+		const long *e;
+		const long *n;
+		const long *ne;
+		long operator*() const { return *p; }
+		iterator &operator++() {
+		    if (++p == e && n) {
+			p = n;
+			e = ne;
+			n = NULL;
+		    }
+		    return *this;
+		}
+		bool operator!=(const iterator &o) const { return p != o.p; }
+	    };
+	    const long *b;
+	    const long *e;
+	    const long *lb;
+	    const long *le;
+	    iterator begin() const {
+		if (b == e)
+		    return iterator{lb, le, NULL, NULL};
+		return iterator{b, e, lb, le};
+	    }
+	    iterator end() const { return iterator{(lb != le) ? le : e, NULL, NULL, NULL}; }
+	    size_t size() const { return (e - b) + (le - lb); }
+	};
+
+	void add(long parent, long child) {
+	    if (parent >= 0) {
+		pending.push_back(std::make_pair(parent, child));
+		stale = true;
+	    }
+	}
+	void add(long child, const git_commitish &from, const std::vector<git_commitish> &merges) {
+	    add(from.index, child);
+	    for (size_t i = 0; i < merges.size(); i++)
+		add(merges[i].index, child);
+	}
+
+	void link(long parent, long child) {
+	    if (parent < 0)
+		return;
+	    pending.push_back(std::make_pair(parent, child));
+	    std::vector<long> *l = linked.find(parent);
+	    if (!l)
+		l = &linked.insert(parent, std::vector<long>());
+	    l->push_back(child);
+	}
+	void link(long child, const git_commitish &from, const std::vector<git_commitish> &merges) {
+	    link(from.index, child);
+	    for (size_t i = 0; i < merges.size(); i++)
+		link(merges[i].index, child);
+	}
+
+	size_t mem_size() const {
+	    return start.capacity() * sizeof(size_t) + cind.capacity() * sizeof(long) +
+		pending.capacity() * sizeof(std::pair<long, long>) + linked.mem_size();
+	}
+
+	// Children of commit p, in the order they were recorded.  (Linking
+	// more children to p invalidates the range - linking to others
+	// doesn't.)
+	range of(long p) {
+	    if (stale)
+		build();
+	    range r = {NULL, NULL, NULL, NULL};
+	    if (p >= 0 && p + 1 < (long)start.size()) {
+		r.b = cind.data() + start[p];
+		r.e = cind.data() + start[p+1];
+	    }
+	    const std::vector<long> *l = linked.find(p);
+	    if (l && l->size()) {
+		r.lb = l->data();
+		r.le = l->data() + l->size();
+	    }
+	    return r;
+	}
+
+    private:
+	// Merge the pending edges into the rows - existing children stay
+	// ahead of new ones.
+	void build() {
+	    size_t ocnt = (start.size()) ? start.size() - 1 : 0;
+	    size_t ncnt = ocnt;
+	    for (size_t i = 0; i < pending.size(); i++)
+		ncnt = std::max(ncnt, (size_t)pending[i].first + 1);
+	    std::vector<size_t> nstart(ncnt + 1, 0);
+	    for (size_t i = 0; i < ocnt; i++)
+		nstart[i+1] = start[i+1] - start[i];
+	    for (size_t i = 0; i < pending.size(); i++)
+		nstart[pending[i].first + 1]++;
+	    for (size_t i = 0; i < ncnt; i++)
+		nstart[i+1] += nstart[i];
+	    std::vector<long> ncind(nstart[ncnt]);
+	    std::vector<size_t> next(nstart.begin(), nstart.end() - 1);
+	    for (size_t i = 0; i < ocnt; i++) {
+		for (size_t j = start[i]; j < start[i+1]; j++)
+		    ncind[next[i]++] = cind[j];
+	    }
+	    for (size_t i = 0; i < pending.size(); i++)
+		ncind[next[pending[i].first]++] = pending[i].second;
+	    start.swap(nstart);
+	    cind.swap(ncind);
+	    pending.clear();
+	    linked.clear();
+	    stale = false;
+	}
+
+	std::vector<size_t> start;
+	std::vector<long> cind;
+	// Edges not yet in the rows.  Linked edges are also kept per parent,
+	// where lookups can see them before the next rebuild.
+	std::vector<std::pair<long, long>> pending;
+	fi_hashmap<long, std::vector<long>> linked;
+	bool stale = false;
+};
+
+/* File modes - these are the only ones fast-import knows about, so there's
+ * no need to carry the octal strings around with every file operation. */
+enum git_mode_t : unsigned char { mode_none = 0, mode_file, mode_exec, mode_symlink, mode_gitlink, mode_dir };
+
+/* Octal string to mode (mode_none if fast-import wouldn't accept it) */
+inline git_mode_t
+git_mode_parse(std::string_view m)
+{
+    if (m == "100644" || m == "644") return mode_file;
+    if (m == "100755" || m == "755") return mode_exec;
+    if (m == "120000") return mode_symlink;
+    if (m == "160000") return mode_gitlink;
+    if (m == "040000") return mode_dir;
+    return mode_none;
+}
+
+inline std::string_view
+git_mode_str(git_mode_t m)
+{
+    static const std::string_view mstr[] = {"", "100644", "100755", "120000", "160000", "040000"};
+    return mstr[m];
+}
+
+/* Bump allocator for strings that live as long as the data set does.  Text
+ * is packed end to end into large blocks, which are never moved or freed
+ * individually, so views into the arena stay valid until it is cleared or
+ * destroyed.  Blocks start out small and double up to FI_ARENA_BLOCK, so
+ * arenas that only ever see a little text (such as those of a staging
+ * git_fi_data) stay small. */
+#define FI_ARENA_BLOCK (1024*1024)
+#define FI_ARENA_MIN_BLOCK 4096
+
+class fi_arena {
+    public:
+	// Empty strings come back as a non-null empty view, so a stored empty
+	// field can be told apart from one that was never set.
+	std::string_view store(std::string_view str) {
+	    if (!str.length())
+		return std::string_view("", 0);
+	    if (str.length() > avail)
+		grow(str.length());
+	    memcpy(next, str.data(), str.length());
+	    std::string_view nstr(next, str.length());
+	    next += str.length();
+	    avail -= str.length();
+	    return nstr;
+	}
+
+	// Drop everything stored so far.  The first block is kept for reuse.
+	void clear() {
+	    if (blocks.size() > 1)
+		blocks.resize(1);
+	    next = (blocks.size()) ? blocks[0].data.get() : NULL;
+	    avail = (blocks.size()) ? blocks[0].size : 0;
+	}
+
+	// Make room for at least n bytes up front (e.g. when the most text
+	// there can be is known)
+	void reserve(size_t n) {
+	    if (n > avail)
+		add_block(n);
+	}
+
+	// Bytes allocated (used or not)
+	size_t mem_size() const {
+	    size_t m = blocks.capacity() * sizeof(block);
+	    for (size_t i = 0; i < blocks.size(); i++)
+		m += blocks[i].size;
+	    return m;
+	}
+
+	// Take over the contents of another arena - views into it stay valid
+	void adopt(fi_arena &o) {
+	    for (size_t i = 0; i < o.blocks.size(); i++)
+		blocks.push_back(std::move(o.blocks[i]));
+	    o.blocks.clear();
+	    o.next = NULL;
+	    o.avail = 0;
+	}
+
+    private:
+	void grow(size_t len) {
+	    add_block(std::max(block_size, len));
+	    block_size = std::min(block_size * 2, (size_t)FI_ARENA_BLOCK);
+	}
+	void add_block(size_t bsize) {
+	    blocks.push_back({std::unique_ptr<char[]>(new char[bsize]), bsize});
+	    next = blocks.back().data.get();
+	    avail = bsize;
+	}
+
+	struct block {
+	    std::unique_ptr<char[]> data;
+	    size_t size;
+	};
+	std::vector<block> blocks;
+	char *next = NULL;
+	size_t avail = 0;
+	size_t block_size = FI_ARENA_MIN_BLOCK;
+};
+
+/* Small sets of labels (branch and tag names) - a sorted vector of views is
+ * a lot lighter than a std::set of strings, and iterates in the same order. */
+typedef std::vector<std::string_view> fi_label_set;
+
+inline void
+fi_label_insert(fi_label_set &labels, std::string_view l)
+{
+    fi_label_set::iterator l_it = std::lower_bound(labels.begin(), labels.end(), l);
+    if (l_it == labels.end() || *l_it != l)
+	labels.insert(l_it, l);
+}
+
+inline bool
+fi_label_erase(fi_label_set &labels, std::string_view l)
+{
+    fi_label_set::iterator l_it = std::lower_bound(labels.begin(), labels.end(), l);
+    if (l_it == labels.end() || *l_it != l)
+	return false;
+    labels.erase(l_it);
+    return true;
+}
+
+/* Paths show up over and over again in file operations, so each distinct
+ * path is stored once (in an arena) and the operations refer to it by a
+ * 32-bit id.  Comparing paths is then just comparing ids.  Id 0 is the
+ * empty path (i.e. no path.) */
+class git_path_table {
+    public:
+	git_path_table() { intern(std::string_view()); }
+
+	uint32_t intern(std::string_view p) {
+	    const uint32_t *id = ids.find(p);
+	    if (id)
+		return *id;
+	    std::string_view np = arena.store(p);
+	    uint32_t nid = (uint32_t)strs.size();
+	    strs.push_back(np);
+	    ids.insert(np, nid);
+	    return nid;
+	}
+	std::string_view str(uint32_t id) const { return strs[id]; }
+	size_t size() const { return strs.size(); }
+	size_t mem_size() const {
+	    return arena.mem_size() + strs.capacity() * sizeof(std::string_view) + ids.mem_size();
+	}
+
+	// Forget every path with an id of n or more - ids below n are kept
+	// as they are.  (For callers done with the operations using them.)
+	void truncate(size_t n) {
+	    if (n >= strs.size())
+		return;
+	    fi_arena old;
+	    old.adopt(arena);
+	    std::vector<std::string_view> nstrs;
+	    ids.clear();
+	    for (size_t i = 0; i < n; i++) {
+		nstrs.push_back(arena.store(strs[i]));
+		ids.insert(nstrs.back(), (uint32_t)i);
+	    }
+	    strs.swap(nstrs);
+	}
+
+    private:
+	fi_arena arena;
+	std::vector<std::string_view> strs;
+	fi_hashmap<std::string_view, uint32_t> ids;
+};
 
 /* Types of git file actions */
-enum git_action_t { filemodify, filedelete, filecopy, filerename, filedeleteall, notemodify };
+enum git_action_t : unsigned char { filemodify, filedelete, filecopy, filerename, filedeleteall, notemodify };
+
+/* File operations are by far the most numerous records in a large history,
+ * so they are kept small and fixed size - no strings of their own.  A
+ * filemodify's data is either a blob mark or an original SHA1. */
 class git_op {
     public:
-	git_action_t type;
-	std::string mode;
-	git_commitish dataref;
-	std::string path;
-	std::string dest_path;
+	git_action_t type = filemodify;
+	git_mode_t mode = mode_none;
+	uint32_t path = 0;       // git_path_table ids
+	uint32_t dest_path = 0;
+	struct {
+	    int32_t mark = -1;
+	    git_oid sha1;
+	} dataref;
 };
 
 class git_fi_data;
 
+/* The text fields of commits and tags are views - into the record arena
+ * of git_fi_data (the parsed text, and anything generated later), or into
+ * the values of the user supplied maps, which don't change once read. */
 class git_commit_data {
     public:
 	git_fi_data *s;
 
 	// Basic commit data
 	git_commitish id;
-	std::string commit_msg;
-	std::string branch;
+	std::string_view commit_msg;
+	std::string_view branch;
 	std::vector<git_op> fileops;  // ordered set of file operations
 
 	// Authorship
-	std::string author;
-	std::string author_timestamp;
-	std::string committer;
-	std::string committer_timestamp;
+	std::string_view author;
+	std::string_view author_timestamp;
+	std::string_view committer;
+	std::string_view committer_timestamp;
 
 	// Relationships with other commits
 	git_commitish from;
@@ -96,7 +1081,7 @@ class git_commit_data {
 	// to keep track of where the note content associated with this commit
 	// is whenever we need it, just provide a convenient place to stash it.
 	// Then we only have to untangle things once.
-	std::string notes_string;
+	std::string_view notes_string;
 
 	// Resets are order dependent - treat them as pseudo-commits for
 	// storage purpose, but they are written differently
@@ -106,31 +1091,37 @@ class git_commit_data {
 	// If this commit is to be removed, set this flag
 	bool skip_commit = false;
 
+	// The message as it will be written, if worked out ahead of time by
+	// git_render_commit_msgs.  (Otherwise it is worked out on write.)
+	std::string_view out_msg;
+	bool have_out_msg = false;
+	bool out_msg_replaced_account = false;
+
 	// Special purpose entries for holding SVN and CVS metadata
-	std::string svn_id;
-	std::set<std::string> svn_branches;
-	std::set<std::string> svn_tags;
-	std::string svn_committer;
-	std::set<std::string> cvs_branches;
-	std::string cvs_committer;
+	std::string_view svn_id;
+	fi_label_set svn_branches;
+	fi_label_set svn_tags;
+	std::string_view svn_committer;
+	fi_label_set cvs_branches;
+	std::string_view cvs_committer;
 };
 
 class git_tag_data {
     public:
 	git_fi_data *s;
-	std::string tag;
+	std::string_view tag;
 	git_commitish id;
 	git_commitish from;
-	std::string tag_msg;
-	std::string tagger;
-	std::string tagger_timestamp;
+	std::string_view tag_msg;
+	std::string_view tagger;
+	std::string_view tagger_timestamp;
 };
 
 class git_blob_data {
     public:
 	git_fi_data *s;
-	size_t offset;
-	size_t length;
+	size_t offset = 0;
+	size_t length = 0;
 	git_commitish id;
 
 	/* If a blob is needed that is not in the original fi file,
@@ -138,6 +1129,65 @@ class git_blob_data {
 	char *cbuffer = NULL;
 };
 
+/* Marks are small, dense integers, so rather than using maps they index
+ * straight into an array.  Each mark assigned on output records the type of
+ * object it identifies and that object's position in its vector (blobs,
+ * commits or tags.)  Input marks are also recorded along with the mark they
+ * were given on output.  Marks nobody has set are reported as unknown rather
+ * than being quietly added. */
+enum git_mark_t { mark_unknown = 0, mark_blob, mark_commit, mark_tag };
+
+class git_mark_table {
+    public:
+	void set(long mark, git_mark_t type, long index) {
+	    entry *e = get(mark);
+	    if (!e) {
+		std::cerr << "Invalid mark: " << mark << "\n";
+		exit(EXIT_FAILURE);
+	    }
+	    e->type = type;
+	    e->index = index;
+	}
+	git_mark_t type(long mark) const {
+	    return (mark >= 0 && mark < (long)marks.size()) ? marks[mark].type : mark_unknown;
+	}
+	bool known(long mark) const { return type(mark) != mark_unknown; }
+	// Position of the object in its vector, or -1 for an unknown mark
+	long index(long mark) const {
+	    return (known(mark)) ? marks[mark].index : -1;
+	}
+
+	void set_remap(long omark, long nmark) {
+	    entry *e = get(omark);
+	    if (!e) {
+		std::cerr << "Invalid mark: " << omark << "\n";
+		exit(EXIT_FAILURE);
+	    }
+	    e->new_mark = nmark;
+	}
+	// Output mark for an input mark, or -1 if the input mark hasn't been seen
+	long remap(long omark) const {
+	    return (omark >= 0 && omark < (long)marks.size()) ? marks[omark].new_mark : -1;
+	}
+
+	size_t mem_size() const { return marks.capacity() * sizeof(entry); }
+
+    private:
+	struct entry {
+	    long index = -1;
+	    long new_mark = -1;
+	    git_mark_t type = mark_unknown;
+	};
+	entry *get(long mark) {
+	    if (mark < 0)
+		return NULL;
+	    if (mark >= (long)marks.size())
+		marks.resize(std::max((size_t)mark + 1, marks.size() * 2));
+	    return &marks[mark];
+	}
+	std::vector<entry> marks;
+};
+
 class git_fi_data {
 
     public:
@@ -147,34 +1197,72 @@ class git_fi_data {
 	bool wrap_commit_lines = false;
 	bool trim_whitespace = false;
 
+	// In stream mode each record is written out as soon as it is parsed
+	// and then discarded, and blob contents go straight from the input to
+	// the output without being stored.  Nothing needs the children index,
+	// so it isn't kept, and the paths of written records are dropped from
+	// time to time.  Only the mark and SHA1 maps grow with the input.
+	bool stream_mode = false;
+
+	// Number of threads to use for work that can be split up
+	int threads = 1;
+
+	// A staging git_fi_data holds the records of one input parsed on its
+	// own (possibly on a worker thread) so they can be merged into the
+	// main data later.  Marks, SHA1s and paths in staged records are left
+	// as they appear in the input - nothing is resolved until the merge,
+	// which takes the records in input order as listed in staged.
+	bool staging = false;
+	std::vector<std::pair<git_mark_t, long>> staged;
+
 	std::vector<git_blob_data> blobs;
 	std::vector<git_tag_data> tags;
 	std::vector<git_commit_data> commits;
 	std::vector<git_commit_data> splice_commits;
-	std::map<long, long> splice_map;
+
+	// Splice commits are numbered after the main commits (splices are
+	// parsed last, so the main commit count doesn't change after they
+	// show up.)  Each commit with splices following it heads a chain -
+	// splice_next holds the index of the commit written after each
+	// commit in a chain, or -1.
+	std::vector<long> splice_next;
+	long splice_after(long index) const {
+	    return (index >= 0 && index < (long)splice_next.size()) ? splice_next[index] : -1;
+	}
+	git_commit_data *commit_at(long index) {
+	    if (index < 0)
+		return NULL;
+	    if (index < (long)commits.size())
+		return &commits[index];
+	    index -= commits.size();
+	    return (index < (long)splice_commits.size()) ? &splice_commits[index] : NULL;
+	}
 
 	// SHA1s are static in this environment, since it is too
 	// difficult to calculate the SHA1 after changing commit
 	// data - therefore, we need to be able to map from old
 	// SHA1 references to mark values.
-	std::map<std::string, long> sha1_to_mark;
-	std::map<long, std::string> mark_to_sha1;
+	fi_hashmap<git_oid, long, git_oid_hash> sha1_to_mark;
+	fi_hashmap<long, git_oid> mark_to_sha1;
 
-	// Marks are unique, and context will make it clear which vector
-	// is being referenced.
-	std::map<long, long> mark_to_index;
-	std::map<long, long> mark_old_to_new;
+	// Marks are unique, and the table records which vector is being
+	// referenced.
+	git_mark_table marks;
 
 	// As long as the proposed mark m is above the range of assigned marks,
 	// go with it.  Otherwise, generate a new mark
-	long next_mark(int m) {
+	long next_mark(long m) {
+	    if (staging) {
+		// Assigned when the record is merged
+		return m;
+	    }
 	    if (m == -1) {
 	       	mark++;
 	    } else {
 		mark = m;
 	    }
 	    if (m != -1) {
-		mark_old_to_new[m] = mark;
+		marks.set_remap(m, mark);
 	    }
 	    return mark;
 	};
@@ -192,18 +1280,34 @@ class git_fi_data {
 	// becomes the reset commit.
 	std::set<std::string> rebuild_commits;
 	std::set<std::string> reset_commits;
-	std::map<std::string, std::set<std::string>> children;
+
+	// Which commits refer to each commit
+	git_child_index children;
 
 	// We also need to be able to translate SVN revs into sha1s
-	std::map<std::string, std::string> rev_to_sha1;
+	fi_hashmap<std::string, git_oid> rev_to_sha1;
+
+	// Paths used by file operations
+	git_path_table paths;
+
+	// Text of the parsed commits and tags (messages, identities, etc.)
+	// along with any replacements generated for them later.
+	fi_arena strings;
+	std::string_view store(std::string_view str) { return strings.store(str); }
 
 
 	// Containers holding information specific to CVS
-	std::map<std::string, std::string> sha12key;
-	std::map<std::string, std::string> key2sha1;
+	fi_hashmap<git_oid, std::string, git_oid_hash> sha12key;
+	fi_hashmap<std::string, git_oid> key2sha1;
 	std::map<std::string, std::string> key2cvsauthor;
 	std::map<std::string, std::string> key2cvsbranch;
 
+	// User supplied maps applied to individual commits
+	std::map<std::string, std::string, std::less<>> email_map;
+	fi_hashmap<git_oid, git_oid, git_oid_hash> blob_map;
+	fi_hashmap<uint32_t, git_mode_t> mode_map; // path id -> mode
+	std::map<std::string, std::string, std::less<>> svn_committer_map;
+
 	// If processing a replacement operation, need to know which commit
 	// to target
 	std::string replace_sha1;
@@ -211,53 +1315,143 @@ class git_fi_data {
 	long mark = -1;
 };
 
-extern int parse_blob(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_commit(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_splice_commit(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_replace_commit(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_add_commit(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_reset(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_tag(git_fi_data *fi_data, std::ifstream &infile);
+extern int parse_blob(git_fi_data *fi_data, git_fi_reader &infile);
+template <fi_parse_mode M> int parse_commit(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_reset(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_tag(git_fi_data *fi_data, git_fi_reader &infile);
+extern int commit_parse_filemodify(git_commit_data *cd, git_fi_reader &infile);
+
+/* Incorporate parsed records (with their references resolved) into the data */
+extern int add_blob(git_fi_data *fi_data, git_blob_data &gbd);
+template <fi_parse_mode M> int add_commit(git_fi_data *fi_data, git_commit_data &gcd);
+extern int add_reset(git_fi_data *fi_data, git_commit_data &gcd);
+extern int add_tag(git_fi_data *fi_data, git_tag_data &gtd);
+extern void commit_resolve_staged(git_commit_data *c, git_fi_data *st, std::vector<uint32_t> &pmap);
+/* Link the parsed splices into the history (after all of them are merged) */
+extern int git_link_splices(git_fi_data *fi_data);
 
 /* Misc commands */
-extern int parse_alias(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_cat_blob(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_checkpoint(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_done(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_feature(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_get_mark(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_progress(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_ls(git_fi_data *fi_data, std::ifstream &infile);
-extern int parse_option(git_fi_data *fi_data, std::ifstream &infile);
+extern int parse_alias(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_cat_blob(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_checkpoint(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_done(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_feature(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_get_mark(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_progress(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_ls(git_fi_data *fi_data, git_fi_reader &infile);
+extern int parse_option(git_fi_data *fi_data, git_fi_reader &infile);
 
 extern int git_unpack_notes(git_fi_data *s, std::string &repo_path);
+extern int git_stream_notes(git_fi_data *s, git_fi_reader &infile);
 extern int git_parse_notes(git_fi_data *s);
 
-extern int git_parse_commitish(git_commitish &gc, git_fi_data *s, std::string line);
+extern int git_parse_commitish(git_commitish &gc, git_fi_data *s, std::string_view line);
+extern int git_resolve_commitish(git_commitish &gc, git_fi_data *s);
 extern int git_remove_commits(git_fi_data *s, std::string &remove_commits);
 extern int git_map_emails(git_fi_data *s, std::string &email_map);
 extern int git_map_blobs(git_fi_data *s, std::string &blob_map);
 extern int git_map_modes(git_fi_data *s, std::string &mode_map);
+extern int read_email_map(git_fi_data *s, std::string &email_map);
+extern int read_blob_map(git_fi_data *s, std::string &blob_map);
+extern int read_mode_map(git_fi_data *s, std::string &mode_map);
+extern void commit_map_emails(git_commit_data *c);
+extern void commit_map_blobs(git_commit_data *c);
+extern void commit_map_modes(git_commit_data *c);
 extern int git_file_inserts(git_fi_data *s, std::string &file_inserts);
 extern int git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_path, std::string &child_commits_file);
 
 
 /* CVS/SVN related functionality */
-extern void parse_cvs_svn_info(git_commit_data *c, std::string &str);
+extern void parse_cvs_svn_info(git_commit_data *c, std::string_view str);
 extern void update_commit_msg(git_commit_data *c);
 extern int git_update_svn_revs(git_fi_data *s, std::string &svn_rev_map);
 extern int git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update_mode);
 extern int git_set_tag_labels(git_fi_data *s, std::string &tag_list);
 
 extern int git_map_svn_committers(git_fi_data *s, std::string &svn_map);
+extern int read_svn_committer_map(git_fi_data *s, std::string &svn_map);
+extern void commit_map_svn_committer(git_commit_data *c);
 extern void read_key_cvsbranch_map(git_fi_data *s, std::string &branchfile);
 extern void read_key_cvsauthor_map(git_fi_data *s, std::string &authorfile);
 extern void read_key_sha1_map(git_fi_data *s, std::string &keysha1file);
 
 /* Output */
-extern int write_blob(std::ofstream &outfile, git_blob_data *b, std::ifstream &infile);
-extern int write_commit(std::ofstream &outfile, git_commit_data *c, git_fi_data *d, std::ifstream &infile);
-extern int write_tag(std::ofstream &outfile, git_tag_data *t, std::ifstream &infile);
+extern int git_render_commit_msgs(git_fi_data *s);
+extern std::string_view commit_msg(git_commit_data *c, fi_arena &arena, bool &replaced_account);
+extern void write_op(git_fi_writer &outfile, git_op *o, git_fi_data *s);
+extern int write_blob(git_fi_writer &outfile, git_blob_data *b, git_fi_reader &infile);
+extern int write_commit(git_fi_writer &outfile, git_commit_data *c, git_fi_data *d);
+extern void write_commit_notices(git_commit_data *c, git_fi_data *d);
+extern int write_commit_quiet(git_fi_writer &outfile, git_commit_data *c, git_fi_data *d);
+extern int write_tag(git_fi_writer &outfile, git_tag_data *t);
+
+/* Timing and counts for each phase of a run (--stats).  A phase runs from
+ * one call of phase() (or start()) to the next, and gets the wall and CPU
+ * time spent, the growth in peak RSS and (if counting) the number of
+ * commits and file operations it added or changed.  Changes are found by
+ * fingerprinting the commits between phases - that work isn't included in
+ * the times.  Phases are also recorded as spans when tracing.
+ *
+ * For --mem-report, the memory held by each of the data structures is
+ * added up at the end of every phase, and the breakdown with the largest
+ * total is kept.
+ *
+ * Until start() is called, phase() does nothing. */
+class fi_stats {
+    public:
+	bool count_changes = false;
+	bool track_memory = false;
+	// Size of the (uncompressed) input, for scaling the memory report
+	size_t input_size = 0;
+
+	void start(git_fi_data *s);
+	// Close the current phase.  bytes is the amount of fast-import data
+	// the phase read or wrote, if it did either.
+	void phase(const char *name, git_fi_data *s, size_t bytes = 0);
+	void report(std::ostream &out, bool json) const;
+	void mem_report(std::ostream &out) const;
+
+    private:
+	struct fi_phase {
+	    std::string name;
+	    double wall;
+	    double cpu;
+	    long rss_kb;
+	    size_t commits;
+	    size_t ops;
+	    size_t bytes;
+	};
+	// One line of a memory breakdown (depth 1 lines are part of the
+	// depth 0 line above them)
+	struct fi_mem_item {
+	    const char *name;
+	    int depth;
+	    size_t bytes;
+	};
+	void snapshot(git_fi_data *s, std::vector<uint64_t> &cfp, std::vector<size_t> &ostart, std::vector<uint32_t> &ofp) const;
+	void mem_sample(git_fi_data *s, const char *name);
+	void mark();
+
+	bool active = false;
+	std::vector<fi_phase> phases;
+
+	// Where the current phase started
+	std::chrono::steady_clock::time_point wall0;
+	double cpu0 = 0;
+	long rss0 = 0;
+
+	// Fingerprints of each commit as of the end of the last phase, and of
+	// each commit's file operations (those of commit i start at ostart[i])
+	std::vector<uint64_t> commit_fp;
+	std::vector<size_t> op_start;
+	std::vector<uint32_t> op_fp;
+
+	// Largest memory breakdown seen, and when
+	std::vector<fi_mem_item> mem_peak;
+	size_t mem_peak_total = 0;
+	std::string mem_peak_phase;
+	size_t mem_peak_commits = 0;
+};
 
 #endif /* REPOWORK_H */
 
@@ -0,0 +1,203 @@
+/*              R E P O W O R K _ B E N C H . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file repowork_bench.cpp
+ *
+ * Time repowork end to end on a fast-import stream (usually one made by
+ * repowork_gen) with each of the main option combinations, and report the
+ * throughput.
+ *
+ * Each combination is timed three ways: parsing alone (no options, with
+ * all output switched off), parsing plus the combination's processing
+ * (output still off) and the full run.  The differences between them give
+ * the time spent on the processing and on writing the output.  Commit
+ * messages are worked out as they are written, so rewrapping and trimming
+ * show up under writing.  --stream runs do everything in one pass and only
+ * have a total.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cxxopts.hpp"
+
+#define BENCH_OUTPUT "repowork_bench_out.fi"
+
+struct bench_case {
+    std::string name;
+    std::vector<std::string> args;
+    bool stream;
+};
+
+// Best wall clock time of runs runs of cmd, or a negative time if it failed
+static double
+bench_time(const std::string &cmd, int runs)
+{
+    double best = -1;
+    for (int i = 0; i < runs; i++) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int ret = std::system((cmd + std::string(" > /dev/null 2>&1")).c_str());
+	std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+	if (ret) {
+	    std::cerr << "Failed: " << cmd << "\n";
+	    return -1;
+	}
+	if (best < 0 || t.count() < best)
+	    best = t.count();
+    }
+    return best;
+}
+
+static std::string
+bench_cmd(const std::string &repowork, int threads, const std::vector<std::string> &args, const std::string &tail)
+{
+    std::string cmd = repowork;
+    if (threads > 0)
+	cmd.append(std::string(" -j ") + std::to_string(threads));
+    for (size_t i = 0; i < args.size(); i++)
+	cmd.append(std::string(" ") + args[i]);
+    cmd.append(std::string(" ") + tail);
+    return cmd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    std::string repowork;
+    std::string email_map;
+    std::string blob_map;
+    int runs = 3;
+    int threads = 0;
+
+    try
+    {
+	cxxopts::Options options(argv[0], " - time repowork on a fast-import stream");
+
+	options.add_options()
+	    ("repowork", "repowork executable to time", cxxopts::value<std::string>(repowork), "path")
+	    ("email-map", "Email map to time --email-map with", cxxopts::value<std::string>(email_map), "file")
+	    ("blob-map", "Blob map to time --blob-map with", cxxopts::value<std::string>(blob_map), "file")
+	    ("runs", "Number of times to run each case (the best time is reported)", cxxopts::value<int>(runs), "N")
+	    ("j,threads", "Number of threads for repowork to use (defaults to its own default)", cxxopts::value<int>(threads), "N")
+	    ("h,help", "Print help")
+	    ;
+
+	auto result = options.parse(argc, argv);
+
+	if (result.count("help"))
+	{
+	    options.custom_help(std::string("[OPTION...] <input_file>"));
+	    std::cout << options.help({""}) << std::endl;
+	    return 0;
+	}
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+	std::cerr << "error parsing options: " << e.what() << std::endl;
+	return -1;
+    }
+
+    if (argc != 2 || !repowork.length()) {
+	std::cout << "repowork_bench --repowork <path> [OPTION...] <input_file>\n";
+	return -1;
+    }
+    std::string ifile(argv[1]);
+
+    // Size up the input
+    std::ifstream in(ifile, std::ifstream::binary);
+    if (!in.good()) {
+	std::cerr << "Could not open input file: " << ifile << "\n";
+	return -1;
+    }
+    double mb = 0;
+    long commits = 0;
+    {
+	char magic[2] = {0, 0};
+	in.read(magic, 2);
+	bool compressed = ((unsigned char)magic[0] == 0x1f && (unsigned char)magic[1] == 0x8b) ||
+	    ((unsigned char)magic[0] == 0x28 && (unsigned char)magic[1] == 0xb5);
+	in.seekg(0, std::ios::end);
+	mb = (double)in.tellg() / (1024.0 * 1024.0);
+	in.seekg(0, std::ios::beg);
+	std::string line;
+	while (!compressed && std::getline(in, line)) {
+	    if (!line.compare(0, 16, "commit refs/head"))
+		commits++;
+	}
+    }
+
+    std::vector<bench_case> cases;
+    cases.push_back({"(none)", {}, false});
+    cases.push_back({"-t", {"-t"}, false});
+    cases.push_back({"-w", {"-w"}, false});
+    cases.push_back({"-t -w", {"-t", "-w"}, false});
+    if (email_map.length())
+	cases.push_back({"--email-map", {"--email-map", email_map}, false});
+    if (blob_map.length())
+	cases.push_back({"--blob-map", {"--blob-map", blob_map}, false});
+    cases.push_back({"--collapse-notes", {"--collapse-notes"}, false});
+    cases.push_back({"--stream", {"--stream"}, true});
+    cases.push_back({"--stream -t -w", {"--stream", "-t", "-w"}, true});
+
+    std::string io = ifile + std::string(" ") + std::string(BENCH_OUTPUT);
+    std::vector<std::string> quiet = {"--no-blobs", "--no-commits", "--no-tags"};
+
+    // One untimed run first, so the first case isn't the one paying to get
+    // the input into the page cache
+    if (bench_time(bench_cmd(repowork, threads, std::vector<std::string>(), io), 1) < 0)
+	return -1;
+
+    double parse = bench_time(bench_cmd(repowork, threads, quiet, io), runs);
+    if (parse < 0)
+	return -1;
+
+    printf("%s: %.1f MB, %ld commits, best of %d\n\n", ifile.c_str(), mb, commits, runs);
+    printf("%-18s %9s %10s %9s %9s %9s %10s\n", "options", "parse s", "process s", "write s", "total s", "MB/s", "commits/s");
+    int ret = 0;
+    for (size_t i = 0; i < cases.size(); i++) {
+	bench_case &c = cases[i];
+	double total = bench_time(bench_cmd(repowork, threads, c.args, io), runs);
+	if (total < 0) {
+	    ret = -1;
+	    continue;
+	}
+	if (c.stream) {
+	    printf("%-18s %9s %10s %9s %9.3f %9.1f %10.0f\n", c.name.c_str(), "-", "-", "-", total, mb / total, commits / total);
+	    continue;
+	}
+	std::vector<std::string> pargs = c.args;
+	pargs.insert(pargs.end(), quiet.begin(), quiet.end());
+	double processed = bench_time(bench_cmd(repowork, threads, pargs, io), runs);
+	if (processed < 0) {
+	    ret = -1;
+	    continue;
+	}
+	// (Differences of short runs can come out slightly negative)
+	double process = std::max(processed - parse, 0.0);
+	double write = std::max(total - processed, 0.0);
+	printf("%-18s %9.3f %10.3f %9.3f %9.3f %9.1f %10.0f\n", c.name.c_str(), parse, process, write, total, mb / total, commits / total);
+    }
+
+    std::remove(BENCH_OUTPUT);
+    return ret;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
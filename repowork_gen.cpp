@@ -0,0 +1,408 @@
+/*                R E P O W O R K _ G E N . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file repowork_gen.cpp
+ *
+ * Generate synthetic git fast-import streams for benchmarking repowork.
+ * The streams look like git fast-export --show-original-ids output from a
+ * CVS/SVN converted repository: blobs interleaved with the commits using
+ * them, a number of branches with merges between them, svn:/cvs: trailers
+ * in the commit messages, notes commits, resets and annotated tags.  The
+ * same options and seed always give the same stream.
+ *
+ * Email and blob maps matching the stream can be written alongside it, for
+ * timing the --email-map and --blob-map options.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cxxopts.hpp"
+
+/* Settings for the stream to generate */
+struct gen_opts {
+    long commits = 10000;
+    int files_per_commit = 3;
+    long blob_min = 64;
+    long blob_max = 64*1024;
+    int branches = 4;
+    double merge_rate = 0.05;
+    double trailer_rate = 0.5;
+    double note_rate = 0.1;
+    long resets = 10;
+    long tags = 10;
+    unsigned long seed = 1;
+};
+
+#define GEN_AUTHORS 50
+#define GEN_TEXT_POOL (1024*1024)
+#define GEN_NOTES_BATCH 1000
+
+static const char *gen_words[] = {
+    "fix", "update", "the", "raytrace", "geometry", "for", "librt", "mged",
+    "add", "remove", "primitive", "tessellation", "build", "cmake", "when",
+    "bot", "brep", "nurbs", "in", "and", "handle", "case", "of", "missing",
+    "memory", "leak", "documentation", "regression", "test", "option"
+};
+
+class gen_state {
+    public:
+	gen_state(const gen_opts &o) : opts(o), rng(o.seed) {}
+
+	gen_opts opts;
+	std::mt19937_64 rng;
+	FILE *out = NULL;
+
+	long mark = 0;
+	std::string text;              // random text to take blob contents from
+	std::vector<std::string> paths;   // files in the tree
+	std::vector<long> heads;          // branch head commit marks (0 - none)
+	std::vector<long> commit_marks;
+	std::vector<std::string> blob_sha1s;
+	std::vector<std::pair<std::string, std::string>> notes; // commit sha1, note
+	long notes_head = 0;
+	long svn_rev = 0;
+
+	double uniform() { return std::uniform_real_distribution<double>(0.0, 1.0)(rng); }
+	long range(long lo, long hi) { return std::uniform_int_distribution<long>(lo, hi)(rng); }
+};
+
+static std::string
+gen_sha1(gen_state &g)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string s(40, '0');
+    for (int i = 0; i < 40; i++)
+	s[i] = digits[g.range(0, 15)];
+    return s;
+}
+
+static std::string
+gen_author(long a)
+{
+    return std::string("Developer ") + std::to_string(a) + std::string(" <dev") + std::to_string(a) + std::string("@example.com>");
+}
+
+static void
+gen_data(gen_state &g, const std::string &d)
+{
+    fprintf(g.out, "data %zu\n", d.length());
+    fwrite(d.data(), 1, d.length(), g.out);
+}
+
+// Blob sizes are spread evenly over orders of magnitude between the minimum
+// and maximum, as file sizes in real trees are
+static long
+gen_blob(gen_state &g)
+{
+    double lmin = std::log((double)std::max(g.opts.blob_min, 1L));
+    double lmax = std::log((double)std::max(g.opts.blob_max, g.opts.blob_min));
+    size_t len = (size_t)std::exp(lmin + (lmax - lmin) * g.uniform());
+    len = std::min(len, g.text.length());
+    size_t start = g.range(0, g.text.length() - len);
+
+    long m = ++g.mark;
+    std::string sha1 = gen_sha1(g);
+    g.blob_sha1s.push_back(sha1);
+    fprintf(g.out, "blob\nmark :%ld\noriginal-oid %s\n", m, sha1.c_str());
+    fprintf(g.out, "data %zu\n", len);
+    fwrite(g.text.data() + start, 1, len, g.out);
+    fputc('\n', g.out);
+    return m;
+}
+
+static std::string
+gen_msg(gen_state &g, int branch)
+{
+    std::string msg;
+    long nwords = g.range(3, 12);
+    // Some messages are single long lines, for the wrapping to work on
+    if (g.uniform() < 0.1)
+	nwords = g.range(20, 40);
+    for (long i = 0; i < nwords; i++) {
+	if (i)
+	    msg.push_back(' ');
+	msg.append(gen_words[g.range(0, sizeof(gen_words)/sizeof(gen_words[0]) - 1)]);
+    }
+    if (g.uniform() < 0.3) {
+	msg.append("\n\n");
+	long blines = g.range(1, 5);
+	for (long i = 0; i < blines; i++) {
+	    for (long j = 0; j < 8; j++) {
+		if (j)
+		    msg.push_back(' ');
+		msg.append(gen_words[g.range(0, sizeof(gen_words)/sizeof(gen_words[0]) - 1)]);
+	    }
+	    msg.push_back('\n');
+	}
+    }
+    // Trailing whitespace, for the trimming to remove
+    if (g.uniform() < 0.2)
+	msg.append("   \n\n\n");
+    if (msg.back() != '\n')
+	msg.push_back('\n');
+
+    if (g.uniform() < g.opts.trailer_rate) {
+	std::string bname = (branch) ? std::string("branch") + std::to_string(branch) : std::string("trunk");
+	msg.append("\n");
+	if (g.uniform() < 0.8) {
+	    msg.append("svn:revision:" + std::to_string(++g.svn_rev) + "\n");
+	    msg.append("svn:branch:" + bname + "\n");
+	    msg.append("svn:account:dev" + std::to_string(g.range(0, GEN_AUTHORS - 1)) + "\n");
+	} else {
+	    msg.append("cvs:branch:" + bname + "\n");
+	    msg.append("cvs:account:dev" + std::to_string(g.range(0, GEN_AUTHORS - 1)) + "\n");
+	}
+    }
+    return msg;
+}
+
+// Write out a notes commit holding the notes collected so far
+static void
+gen_notes_commit(gen_state &g, long t)
+{
+    if (!g.notes.size())
+	return;
+
+    std::vector<long> nblobs;
+    for (size_t i = 0; i < g.notes.size(); i++) {
+	long m = ++g.mark;
+	fprintf(g.out, "blob\nmark :%ld\noriginal-oid %s\n", m, gen_sha1(g).c_str());
+	gen_data(g, g.notes[i].second);
+	fputc('\n', g.out);
+	nblobs.push_back(m);
+    }
+
+    long m = ++g.mark;
+    std::string author = gen_author(0);
+    fprintf(g.out, "commit refs/notes/commits\nmark :%ld\noriginal-oid %s\n", m, gen_sha1(g).c_str());
+    fprintf(g.out, "author %s %ld +0000\ncommitter %s %ld +0000\n", author.c_str(), t, author.c_str(), t);
+    gen_data(g, std::string("Notes added by 'git notes add'\n"));
+    if (g.notes_head)
+	fprintf(g.out, "from :%ld\n", g.notes_head);
+    for (size_t i = 0; i < g.notes.size(); i++) {
+	// Large notes trees are split into fanout directories
+	const std::string &s = g.notes[i].first;
+	fprintf(g.out, "M 100644 :%ld %s/%s\n", nblobs[i], s.substr(0, 2).c_str(), s.substr(2).c_str());
+    }
+    fputc('\n', g.out);
+    g.notes_head = m;
+    g.notes.clear();
+}
+
+static void
+gen_commit(gen_state &g, long i)
+{
+    long t = 1000000000 + i * 600;
+    int branch = (int)g.range(0, g.opts.branches - 1);
+
+    // Changes - mostly edits to existing files, some new files and the
+    // occasional delete
+    std::vector<std::pair<long, size_t>> mods;
+    std::vector<size_t> dels;
+    long nfiles = g.range(1, std::max(2 * g.opts.files_per_commit - 1, 1));
+    for (long f = 0; f < nfiles; f++) {
+	double r = g.uniform();
+	if (!g.paths.size() || r < 0.2) {
+	    size_t n = g.paths.size();
+	    g.paths.push_back("src/dir" + std::to_string(n / 50) + "/file" + std::to_string(n) + ".c");
+	    mods.push_back(std::make_pair(gen_blob(g), n));
+	} else if (r < 0.25 && g.paths.size() > 10) {
+	    dels.push_back(g.range(0, g.paths.size() - 1));
+	} else {
+	    mods.push_back(std::make_pair(gen_blob(g), (size_t)g.range(0, g.paths.size() - 1)));
+	}
+    }
+
+    long m = ++g.mark;
+    std::string sha1 = gen_sha1(g);
+    std::string author = gen_author(g.range(0, GEN_AUTHORS - 1));
+    std::string bname = (branch) ? std::string("branch") + std::to_string(branch) : std::string("master");
+    fprintf(g.out, "commit refs/heads/%s\nmark :%ld\noriginal-oid %s\n", bname.c_str(), m, sha1.c_str());
+    fprintf(g.out, "author %s %ld +0000\ncommitter %s %ld +0000\n", author.c_str(), t, author.c_str(), t);
+    gen_data(g, gen_msg(g, branch));
+
+    // New branches start from master
+    long from = (g.heads[branch]) ? g.heads[branch] : g.heads[0];
+    if (from)
+	fprintf(g.out, "from :%ld\n", from);
+    if (g.opts.branches > 1 && g.uniform() < g.opts.merge_rate) {
+	int mbranch = (int)g.range(0, g.opts.branches - 1);
+	if (mbranch != branch && g.heads[mbranch] && g.heads[mbranch] != from)
+	    fprintf(g.out, "merge :%ld\n", g.heads[mbranch]);
+    }
+    for (size_t d = 0; d < dels.size(); d++)
+	fprintf(g.out, "D %s\n", g.paths[dels[d]].c_str());
+    for (size_t d = 0; d < mods.size(); d++)
+	fprintf(g.out, "M 100644 :%ld %s\n", mods[d].first, g.paths[mods[d].second].c_str());
+    fputc('\n', g.out);
+
+    g.heads[branch] = m;
+    g.commit_marks.push_back(m);
+
+    if (g.uniform() < g.opts.note_rate) {
+	std::string note = "svn:revision:" + std::to_string(i + 1) + "\nsvn:branch:" + ((branch) ? bname : std::string("trunk")) + "\n";
+	g.notes.push_back(std::make_pair(sha1, note));
+    }
+    if (g.notes.size() >= GEN_NOTES_BATCH)
+	gen_notes_commit(g, t);
+}
+
+static void
+gen_reset(gen_state &g)
+{
+    int branch = (int)g.range(0, g.opts.branches - 1);
+    if (!g.heads[branch])
+	return;
+    std::string bname = (branch) ? std::string("branch") + std::to_string(branch) : std::string("master");
+    fprintf(g.out, "reset refs/heads/%s\nfrom :%ld\n\n", bname.c_str(), g.heads[branch]);
+}
+
+static void
+gen_tag(gen_state &g, long n)
+{
+    if (!g.commit_marks.size())
+	return;
+    long target = g.commit_marks[g.range(0, g.commit_marks.size() - 1)];
+    std::string tagger = gen_author(g.range(0, GEN_AUTHORS - 1));
+    fprintf(g.out, "tag rel-%ld\nmark :%ld\nfrom :%ld\noriginal-oid %s\n", n, ++g.mark, target, gen_sha1(g).c_str());
+    fprintf(g.out, "tagger %s %ld +0000\n", tagger.c_str(), 1000000000 + n * 86400);
+    gen_data(g, "Release " + std::to_string(n) + "\n");
+    fputc('\n', g.out);
+}
+
+int
+main(int argc, char *argv[])
+{
+    gen_opts opts;
+    std::string email_map_out;
+    std::string blob_map_out;
+
+    try
+    {
+	cxxopts::Options options(argv[0], " - generate synthetic git fast-import streams");
+
+	options.add_options()
+	    ("c,commits", "Number of commits", cxxopts::value<long>(opts.commits), "N")
+	    ("files-per-commit", "Average number of files changed by each commit", cxxopts::value<int>(opts.files_per_commit), "N")
+	    ("blob-min", "Smallest blob size in bytes", cxxopts::value<long>(opts.blob_min), "bytes")
+	    ("blob-max", "Largest blob size in bytes (sizes are spread log-uniformly between the two)", cxxopts::value<long>(opts.blob_max), "bytes")
+	    ("branches", "Number of branches", cxxopts::value<int>(opts.branches), "N")
+	    ("merge-rate", "Fraction of commits merging in another branch", cxxopts::value<double>(opts.merge_rate), "fraction")
+	    ("trailer-rate", "Fraction of commit messages with svn:/cvs: trailers", cxxopts::value<double>(opts.trailer_rate), "fraction")
+	    ("note-rate", "Fraction of commits with a git note", cxxopts::value<double>(opts.note_rate), "fraction")
+	    ("resets", "Number of branch resets", cxxopts::value<long>(opts.resets), "N")
+	    ("tags", "Number of annotated tags", cxxopts::value<long>(opts.tags), "N")
+	    ("seed", "Random seed", cxxopts::value<unsigned long>(opts.seed), "N")
+	    ("email-map-out", "Write an email map renaming every author to this file", cxxopts::value<std::string>(email_map_out), "file")
+	    ("blob-map-out", "Write a blob map replacing some of the blobs to this file", cxxopts::value<std::string>(blob_map_out), "file")
+	    ("h,help", "Print help")
+	    ;
+
+	auto result = options.parse(argc, argv);
+
+	if (result.count("help"))
+	{
+	    options.custom_help(std::string("[OPTION...] [<output_file>|-]"));
+	    std::cout << options.help({""}) << std::endl;
+	    return 0;
+	}
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+	std::cerr << "error parsing options: " << e.what() << std::endl;
+	return -1;
+    }
+
+    if (argc > 2) {
+	std::cout << "repowork_gen [OPTION...] [<output_file>|-]\n";
+	return -1;
+    }
+    if (opts.commits < 0 || opts.files_per_commit < 1 || opts.blob_min < 0 || opts.blob_max < opts.blob_min || opts.branches < 1) {
+	std::cerr << "Invalid settings\n";
+	return -1;
+    }
+
+    gen_state g(opts);
+    std::string ofile = (argc > 1) ? std::string(argv[1]) : std::string("-");
+    g.out = (ofile == std::string("-")) ? stdout : fopen(ofile.c_str(), "wb");
+    if (!g.out) {
+	std::cerr << "Could not open output file: " << ofile << "\n";
+	return -1;
+    }
+    std::vector<char> obuf(1024*1024);
+    setvbuf(g.out, obuf.data(), _IOFBF, obuf.size());
+
+    // Blob contents are slices of one block of random text
+    g.text.resize(std::max((long)GEN_TEXT_POOL, opts.blob_max));
+    for (size_t i = 0; i < g.text.length(); i++) {
+	long r = g.range(0, 63);
+	g.text[i] = (r == 0) ? '\n' : (r < 8) ? ' ' : (char)('a' + r % 26);
+    }
+    g.heads.resize(opts.branches, 0);
+
+    // Resets are spread through the history at random
+    std::vector<long> reset_at;
+    for (long i = 0; i < opts.resets; i++)
+	reset_at.push_back(g.range(1, std::max(opts.commits, 1L)));
+    std::sort(reset_at.begin(), reset_at.end());
+
+    size_t r = 0;
+    for (long i = 0; i < opts.commits; i++) {
+	gen_commit(g, i);
+	for (; r < reset_at.size() && reset_at[r] <= i + 1; r++)
+	    gen_reset(g);
+    }
+    gen_notes_commit(g, 1000000000 + opts.commits * 600);
+    for (long i = 0; i < opts.tags; i++)
+	gen_tag(g, i);
+
+    if (fflush(g.out) || (g.out != stdout && fclose(g.out))) {
+	std::cerr << "Error writing output\n";
+	return -1;
+    }
+
+    if (email_map_out.length()) {
+	FILE *ef = fopen(email_map_out.c_str(), "wb");
+	if (!ef) {
+	    std::cerr << "Could not open email map file: " << email_map_out << "\n";
+	    return -1;
+	}
+	for (long a = 0; a < GEN_AUTHORS; a++)
+	    fprintf(ef, "%s;Renamed Developer %ld <renamed%ld@example.org>\n", gen_author(a).c_str(), a, a);
+	fclose(ef);
+    }
+
+    // Every hundredth blob is replaced by the blob before it
+    if (blob_map_out.length()) {
+	FILE *bf = fopen(blob_map_out.c_str(), "wb");
+	if (!bf) {
+	    std::cerr << "Could not open blob map file: " << blob_map_out << "\n";
+	    return -1;
+	}
+	for (size_t b = 100; b < g.blob_sha1s.size(); b += 100)
+	    fprintf(bf, "%s;%s\n", g.blob_sha1s[b].c_str(), g.blob_sha1s[b - 1].c_str());
+	fclose(bf);
+    }
+
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -0,0 +1,360 @@
+/*        R E P O W O R K _ M I C R O B E N C H . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file repowork_microbench.cpp
+ *
+ * Time the routines repowork runs once per line, per file operation or per
+ * commit, on fixed inputs, and report the time and number of heap
+ * allocations (operator new calls) each call costs.  End to end timings
+ * (repowork_bench) say how long a run takes - this says which of the small
+ * per-record costs adds up to it.
+ *
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <unistd.h>
+
+#include "cxxopts.hpp"
+#include "TextFlow.hpp"
+#include "repowork.h"
+
+// Input lines are parsed MB_LINES at a time, rewinding between passes
+#define MB_LINES 1024
+// Generated text (message rewrites) is thrown away every MB_ARENA_OPS calls
+#define MB_ARENA_OPS 4096
+
+/* Every allocation the routines make goes through here to be counted.  The
+ * whole family of global allocation functions is replaced, so every form of
+ * new is counted and every form of delete matches its new.  (They are kept
+ * out of line - if GCC inlines a delete into its caller it sees free called
+ * on the result of new, and warns about the mismatch.) */
+static size_t mb_allocs = 0;
+
+#define MB_NOINLINE __attribute__((noinline))
+
+MB_NOINLINE static void *
+mb_alloc(size_t n, size_t align)
+{
+    mb_allocs++;
+    n = (n) ? n : 1;
+    if (align <= alignof(std::max_align_t))
+	return malloc(n);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return aligned_alloc(align, (n + align - 1) / align * align);
+}
+
+MB_NOINLINE static void
+mb_free(void *p)
+{
+    free(p);
+}
+
+MB_NOINLINE void *
+operator new(size_t n)
+{
+    void *p = mb_alloc(n, 0);
+    if (!p)
+	throw std::bad_alloc();
+    return p;
+}
+
+MB_NOINLINE void *
+operator new[](size_t n)
+{
+    return operator new(n);
+}
+
+MB_NOINLINE void *
+operator new(size_t n, const std::nothrow_t &) noexcept
+{
+    return mb_alloc(n, 0);
+}
+
+MB_NOINLINE void *
+operator new[](size_t n, const std::nothrow_t &) noexcept
+{
+    return mb_alloc(n, 0);
+}
+
+MB_NOINLINE void *
+operator new(size_t n, std::align_val_t a)
+{
+    void *p = mb_alloc(n, (size_t)a);
+    if (!p)
+	throw std::bad_alloc();
+    return p;
+}
+
+MB_NOINLINE void *
+operator new[](size_t n, std::align_val_t a)
+{
+    return operator new(n, a);
+}
+
+MB_NOINLINE void operator delete(void *p) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete[](void *p) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete(void *p, size_t) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete[](void *p, size_t) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete(void *p, const std::nothrow_t &) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete[](void *p, const std::nothrow_t &) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete(void *p, std::align_val_t) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete[](void *p, std::align_val_t) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete(void *p, size_t, std::align_val_t) noexcept { mb_free(p); }
+MB_NOINLINE void operator delete[](void *p, size_t, std::align_val_t) noexcept { mb_free(p); }
+
+// Results are added up here so the calls can't be optimized away
+static volatile size_t mb_sink = 0;
+
+static size_t mb_iterations = 1000000;
+static int mb_runs = 3;
+
+// Call f(i) n times (after a short warm up) runs times, and report the best
+// time per call along with the allocations per call
+template <typename F>
+static void
+mb_run(const char *name, size_t n, F &&f)
+{
+    n = std::max(n, (size_t)1);
+    for (size_t i = 0; i < n / 10 + 1; i++)
+	f(i);
+
+    double best = -1;
+    size_t allocs = 0;
+    for (int r = 0; r < mb_runs; r++) {
+	size_t a = mb_allocs;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i++)
+	    f(i);
+	std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - start;
+	if (best < 0 || t.count() < best)
+	    best = t.count();
+	allocs = mb_allocs - a;
+    }
+    printf("%-36s %12.1f %12.2f\n", name, best / n, (double)allocs / n);
+}
+
+// Made up (but fixed) SHA1 for object i
+static std::string
+mb_sha1(size_t i)
+{
+    char h[41];
+    uint64_t x = i * 0x9e3779b97f4a7c15ULL + 1;
+    for (int j = 0; j < 40; j += 8) {
+	x ^= x >> 29;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	snprintf(h + j, 9, "%08x", (unsigned)(x >> 32));
+    }
+    return std::string(h, 40);
+}
+
+static const std::string mb_msg_plain =
+    "Rework the boolean weaving code so that overlapping partitions from more than two regions are resolved in a single pass rather than pairwise.   \n";
+
+static const std::string mb_msg_svn =
+    "Fix a crash in the raytracer when a region has no material assigned.\n"
+    "\n"
+    "The shader lookup assumed a default material was always present, which\n"
+    "is not the case for databases converted from older formats.\n"
+    "\n"
+    "svn:revision:31337\n"
+    "svn:branch:trunk\n"
+    "svn:account:jdoe\n";
+
+// A longer message carrying every kind of info line, the way converted
+// histories that went through both CVS and SVN end up
+static const std::string mb_msg_trailers =
+    "Merge the tessellation fixes from the release branch.\n"
+    "\n"
+    "The plate mode changes conflicted with the new bounding box code, so\n"
+    "the merge keeps the trunk version of the bounding box routines and\n"
+    "reapplies the plate mode fixes on top of them.\n"
+    "\n"
+    "svn:revision:31337\n"
+    "svn:branch:rel-7-32\n"
+    "svn:tag:rel-7-32-4\n"
+    "svn:account:jdoe\n"
+    "cvs:branch:rel-7-32\n"
+    "cvs:account:jdoe\n";
+
+static const std::string mb_msg_paras =
+    "Rework the boolean weaving code so that overlapping partitions from more than two regions are resolved in a single pass rather than pairwise, which was both slow and occasionally wrong.\n"
+    "\n"
+    "The old approach is kept behind a flag for now so results can be compared on the regression databases before it goes away entirely.  \n";
+
+int
+main(int argc, char *argv[])
+{
+    try
+    {
+	cxxopts::Options options(argv[0], " - time repowork's per-record routines");
+
+	options.add_options()
+	    ("n,iterations", "Calls per timing of the cheaper routines (the more expensive ones get a tenth as many)", cxxopts::value<size_t>(mb_iterations), "N")
+	    ("runs", "Number of timings of each routine (the best is reported)", cxxopts::value<int>(mb_runs), "N")
+	    ("h,help", "Print help")
+	    ;
+
+	auto result = options.parse(argc, argv);
+
+	if (result.count("help"))
+	{
+	    options.custom_help(std::string("[OPTION...]"));
+	    std::cout << options.help({""}) << std::endl;
+	    return 0;
+	}
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+	std::cerr << "error parsing options: " << e.what() << std::endl;
+	return -1;
+    }
+
+    size_t n = mb_iterations;
+    size_t n_slow = n / 10;
+
+    // Data set with MB_LINES blobs, known by both mark and SHA1
+    git_fi_data s;
+    std::vector<std::string> sha1s;
+    for (long m = 1; m <= MB_LINES; m++) {
+	s.next_mark(m);
+	s.marks.set(m, mark_blob, m - 1);
+	sha1s.push_back(mb_sha1(m));
+	s.sha1_to_mark.insert(git_oid(sha1s.back()), m);
+    }
+    std::vector<std::string> mark_refs;
+    for (long m = 1; m <= MB_LINES; m++)
+	mark_refs.push_back(std::string(":") + std::to_string(m));
+
+    printf("%-36s %12s %12s\n", "routine", "ns/op", "allocs/op");
+
+    mb_run("git_parse_commitish (mark)", n, [&](size_t i) {
+	git_commitish gc;
+	git_parse_commitish(gc, &s, mark_refs[i % MB_LINES]);
+	mb_sink += gc.index;
+    });
+
+    mb_run("git_parse_commitish (SHA1)", n, [&](size_t i) {
+	git_commitish gc;
+	git_parse_commitish(gc, &s, sha1s[i % MB_LINES]);
+	mb_sink += gc.index;
+    });
+
+    // Modify lines referring to blobs by mark and by SHA1, spread over a
+    // few hundred paths
+    FILE *mfp = tmpfile();
+    if (!mfp) {
+	std::cerr << "Could not create temporary file\n";
+	return -1;
+    }
+    for (size_t i = 0; i < MB_LINES; i++) {
+	std::string ref = (i % 2) ? sha1s[i] : mark_refs[i];
+	fprintf(mfp, "M %s %s src/librt/primitives/dir%zu/file%zu.c\n", (i % 7) ? "100644" : "100755", ref.c_str(), i % 37, i % 300);
+    }
+    fflush(mfp);
+    git_fi_reader mreader;
+    if (mreader.open_fd(fileno(mfp), false)) {
+	std::cerr << "Could not open temporary file\n";
+	return -1;
+    }
+    git_commit_data mc;
+    mc.s = &s;
+    mc.fileops.reserve(MB_LINES);
+    mb_run("commit_parse_filemodify", n, [&](size_t i) {
+	if (!(i % MB_LINES)) {
+	    mreader.rewind();
+	    mc.fileops.clear();
+	}
+	commit_parse_filemodify(&mc, mreader);
+    });
+    mreader.close();
+    fclose(mfp);
+
+    // The ops just parsed are the ones written
+    git_fi_writer counter;
+    counter.open_count();
+    mb_run("write_op", n, [&](size_t i) {
+	write_op(counter, &mc.fileops[i % mc.fileops.size()], &s);
+    });
+    mb_sink += counter.written();
+    counter.close();
+
+    git_commit_data c;
+    c.s = &s;
+    mb_run("parse_cvs_svn_info (no info)", n, [&](size_t) {
+	parse_cvs_svn_info(&c, mb_msg_plain);
+	mb_sink += c.svn_id.length();
+    });
+    mb_run("parse_cvs_svn_info (svn info)", n, [&](size_t) {
+	parse_cvs_svn_info(&c, mb_msg_svn);
+	mb_sink += c.svn_id.length();
+    });
+
+    mb_run("parse_cvs_svn_info (trailer heavy)", n, [&](size_t) {
+	parse_cvs_svn_info(&c, mb_msg_trailers);
+	mb_sink += c.svn_id.length();
+    });
+
+    // (The info found above is what gets written back)
+    parse_cvs_svn_info(&c, mb_msg_svn);
+    mb_run("update_commit_msg", n_slow, [&](size_t i) {
+	if (!(i % MB_ARENA_OPS))
+	    s.strings.clear();
+	c.commit_msg = mb_msg_svn;
+	update_commit_msg(&c);
+	mb_sink += c.commit_msg.length();
+    });
+    parse_cvs_svn_info(&c, mb_msg_trailers);
+    mb_run("update_commit_msg (trailer heavy)", n_slow, [&](size_t i) {
+	if (!(i % MB_ARENA_OPS))
+	    s.strings.clear();
+	c.commit_msg = mb_msg_trailers;
+	update_commit_msg(&c);
+	mb_sink += c.commit_msg.length();
+    });
+
+    git_commit_data mc2;
+    mc2.s = &s;
+    mc2.commit_msg = mb_msg_paras;
+    fi_arena arena;
+    s.trim_whitespace = true;
+    mb_run("commit_msg (trim)", n_slow, [&](size_t i) {
+	if (!(i % MB_ARENA_OPS))
+	    arena.clear();
+	bool replaced = false;
+	mb_sink += commit_msg(&mc2, arena, replaced).length();
+    });
+    s.wrap_commit_lines = true;
+    mb_run("commit_msg (trim, wrap)", n_slow, [&](size_t i) {
+	if (!(i % MB_ARENA_OPS))
+	    arena.clear();
+	bool replaced = false;
+	mb_sink += commit_msg(&mc2, arena, replaced).length();
+    });
+    s.trim_whitespace = false;
+    s.wrap_commit_lines = false;
+
+    mb_run("TextFlow::Column (72 wide)", n_slow, [&](size_t) {
+	std::string w = TextFlow::Column(mb_msg_plain).width(72).toString();
+	mb_sink += w.length();
+    });
+
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
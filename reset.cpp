@@ -14,40 +14,25 @@
 
 #include "repowork.h"
 
-typedef int (*resetcmd_t)(git_commit_data *, std::ifstream &);
-resetcmd_t
-reset_find_cmd(std::string &line, std::map<std::string, resetcmd_t> &cmdmap)
-{
-    resetcmd_t cc = NULL;
-    std::map<std::string, resetcmd_t>::iterator c_it;
-    for (c_it = cmdmap.begin(); c_it != cmdmap.end(); c_it++) {
-	if (!ficmp(line, c_it->first)) {
-	    cc = c_it->second;
-	    break;
-	}
-    }
-    return cc;
-}
-
 int
-reset_parse_reset(git_commit_data *cd, std::ifstream &infile)
+reset_parse_reset(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 6);  // Remove "reset " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 6);  // Remove "reset " prefix
     // Stash the reference in the branch string.  It may be
     // a tag rather than a branch, so in this case we save
     // the full reference path
-    cd->branch = line;
+    cd->branch = cd->s->store(line);
     return 0;
 }
 
 int
-reset_parse_from(git_commit_data *cd, std::ifstream &infile)
+reset_parse_from(git_commit_data *cd, git_fi_reader &infile)
 {
-    std::string line;
-    std::getline(infile, line);
-    line.erase(0, 5); // Remove "from " prefix
+    std::string_view line;
+    infile.getline(line);
+    line = fi_strip(line, 5); // Remove "from " prefix
     //std::cout << "from line: " << line << "\n";
     int ret = git_parse_commitish(cd->from, cd->s, line);
     if (!ret) {
@@ -57,8 +42,13 @@ reset_parse_from(git_commit_data *cd, std::ifstream &infile)
     exit(EXIT_FAILURE);
 }
 
+static constexpr auto reset_cmds = fi_cmd_table_make<git_commit_data>({
+    {"reset", reset_parse_reset},
+    {"from", reset_parse_from}
+});
+
 int
-parse_reset(git_fi_data *fi_data, std::ifstream &infile)
+parse_reset(git_fi_data *fi_data, git_fi_reader &infile)
 {
     //std::cout << "Found command: reset\n";
 
@@ -66,42 +56,32 @@ parse_reset(git_fi_data *fi_data, std::ifstream &infile)
     gcd.s = fi_data;
     gcd.reset_commit = 1;
 
-    // Tell the reset where it will be in the vector.
-    gcd.id.index = fi_data->commits.size();
+    fi_parse_record(&gcd, infile, reset_cmds);
 
-    std::map<std::string, resetcmd_t> cmdmap;
-    cmdmap[std::string("reset")] = reset_parse_reset;
-    cmdmap[std::string("from")] = reset_parse_from;
-
-    std::string line;
-    size_t offset = infile.tellg();
-    int reset_done = 0;
-    while (!reset_done && std::getline(infile, line)) {
+    if (fi_data->staging) {
+	fi_data->staged.push_back(std::make_pair(mark_commit, (long)fi_data->commits.size()));
+	fi_data->commits.push_back(std::move(gcd));
+	return 0;
+    }
 
-	resetcmd_t cc = reset_find_cmd(line, cmdmap);
+    return add_reset(fi_data, gcd);
+}
 
-	// If we found a command, process it.  Otherwise, we are done
-	// with the reset and need to clean up.
-	if (cc) {
-	    //std::cout << "reset line: " << line << "\n";
-	    infile.seekg(offset);
-	    (*cc)(&gcd, infile);
-	    offset = infile.tellg();
-	} else {
-	    // Whatever was on that line, it's not a reset input.
-	    // Reset input to allow the parent routine to deal with
-	    // it, and return.
-	    infile.seekg(offset);
-	    reset_done = 1;
-	}
-    }
+int
+add_reset(git_fi_data *fi_data, git_commit_data &gcd)
+{
+    // Tell the reset where it will be in the vector.
+    gcd.id.index = fi_data->commits.size();
 
     // resets don't get a mark - they are written out in the stream
     // in commit order
     gcd.id.mark = 0;
+    if (!fi_data->stream_mode) {
+	fi_data->children.add(gcd.id.index, gcd.from, gcd.merges);
+    }
 
     // Add the reset to the commit data
-    fi_data->commits.push_back(gcd);
+    fi_data->commits.push_back(std::move(gcd));
 
     return 0;
 }
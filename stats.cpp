@@ -0,0 +1,403 @@
+/*                      S T A T S . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file stats.cpp
+ *
+ * Per phase timing and counts (--stats), so the cost of each step of a
+ * rewrite can be tracked from one run to the next, and the memory used by
+ * each of the data structures (--mem-report.)
+ *
+ */
+
+#include <cstdio>
+
+#include <sys/resource.h>
+
+#include "repowork.h"
+
+static inline uint64_t
+stats_mix(uint64_t h, uint64_t v)
+{
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h;
+}
+
+// Text is compared by content - rewriting a field with the same text (as
+// relabeling does with unchanged labels) doesn't count as a change.
+static inline uint64_t
+stats_mix(uint64_t h, std::string_view v)
+{
+    return stats_mix(h, (uint64_t)std::hash<std::string_view>()(v));
+}
+
+static inline uint64_t
+stats_mix(uint64_t h, const git_commitish &c)
+{
+    h = stats_mix(h, (uint64_t)c.index);
+    h = stats_mix(h, (uint64_t)c.mark);
+    uint64_t b[3] = {0, 0, 0};
+    memcpy(b, c.sha1.b, sizeof(c.sha1.b));
+    return stats_mix(stats_mix(stats_mix(h, b[0]), b[1]), b[2]);
+}
+
+static inline uint64_t
+stats_mix(uint64_t h, const fi_label_set &l)
+{
+    h = stats_mix(h, (uint64_t)l.size());
+    for (size_t i = 0; i < l.size(); i++)
+	h = stats_mix(h, l[i]);
+    return h;
+}
+
+// Operations are compared as they would be written - filling in the SHA1
+// of a blob referred to by mark isn't a change.
+static uint32_t
+stats_op_fp(git_fi_data *s, const git_op &o)
+{
+    uint64_t h = stats_mix(0, ((uint64_t)o.type << 8) | o.mode);
+    h = stats_mix(h, ((uint64_t)o.path << 32) | o.dest_path);
+    const git_oid *oid = &o.dataref.sha1;
+    if (oid->is_null() && o.dataref.mark > -1) {
+	const git_oid *moid = s->mark_to_sha1.find(o.dataref.mark);
+	if (moid)
+	    oid = moid;
+    }
+    if (oid->is_null())
+	h = stats_mix(h, (uint64_t)(uint32_t)o.dataref.mark);
+    uint64_t b[3] = {0, 0, 0};
+    memcpy(b, oid->b, sizeof(oid->b));
+    h = stats_mix(stats_mix(stats_mix(h, b[0]), b[1]), b[2]);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static double
+stats_cpu(long *maxrss)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru)) {
+	*maxrss = 0;
+	return 0;
+    }
+    *maxrss = ru.ru_maxrss;
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+void
+fi_stats::snapshot(git_fi_data *s, std::vector<uint64_t> &cfp, std::vector<size_t> &ostart, std::vector<uint32_t> &ofp) const
+{
+    size_t ccnt = s->commits.size() + s->splice_commits.size();
+    cfp.resize(ccnt);
+    ostart.resize(ccnt + 1);
+    ofp.clear();
+    for (size_t i = 0; i < ccnt; i++) {
+	const git_commit_data *c = s->commit_at(i);
+	uint64_t h = stats_mix(0, c->id);
+	h = stats_mix(h, c->commit_msg);
+	h = stats_mix(h, c->branch);
+	h = stats_mix(h, c->author);
+	h = stats_mix(h, c->author_timestamp);
+	h = stats_mix(h, c->committer);
+	h = stats_mix(h, c->committer_timestamp);
+	h = stats_mix(h, c->from);
+	h = stats_mix(h, (uint64_t)c->merges.size());
+	for (size_t j = 0; j < c->merges.size(); j++)
+	    h = stats_mix(h, c->merges[j]);
+	h = stats_mix(h, c->notes_string);
+	h = stats_mix(h, ((uint64_t)c->notes_commit << 2) | ((uint64_t)c->reset_commit << 1) | (uint64_t)c->skip_commit);
+	h = stats_mix(h, c->svn_id);
+	h = stats_mix(h, c->svn_branches);
+	h = stats_mix(h, c->svn_tags);
+	h = stats_mix(h, c->svn_committer);
+	h = stats_mix(h, c->cvs_branches);
+	h = stats_mix(h, c->cvs_committer);
+	cfp[i] = h;
+	ostart[i] = ofp.size();
+	for (size_t j = 0; j < c->fileops.size(); j++)
+	    ofp.push_back(stats_op_fp(s, c->fileops[j]));
+    }
+    ostart[ccnt] = ofp.size();
+}
+
+void
+fi_stats::mark()
+{
+    wall0 = std::chrono::steady_clock::now();
+    cpu0 = stats_cpu(&rss0);
+}
+
+void
+fi_stats::start(git_fi_data *s)
+{
+    active = true;
+    phases.clear();
+    commit_fp.clear();
+    op_start.clear();
+    op_fp.clear();
+    mem_peak.clear();
+    mem_peak_total = 0;
+    if (count_changes)
+	snapshot(s, commit_fp, op_start, op_fp);
+    mark();
+}
+
+void
+fi_stats::phase(const char *name, git_fi_data *s, size_t bytes)
+{
+    if (!active)
+	return;
+
+    std::chrono::steady_clock::time_point wall1 = std::chrono::steady_clock::now();
+    std::chrono::duration<double> wall = wall1 - wall0;
+    long rss = 0;
+    double cpu = stats_cpu(&rss);
+    if (fi_tracer.enabled())
+	fi_tracer.add(name, fi_tracer.us(wall0), fi_tracer.us(wall1), std::string());
+
+    fi_phase p;
+    p.name = std::string(name);
+    p.wall = wall.count();
+    p.cpu = cpu - cpu0;
+    p.rss_kb = rss - rss0;
+    p.commits = 0;
+    p.ops = 0;
+    p.bytes = bytes;
+
+    if (track_memory)
+	mem_sample(s, name);
+
+    if (count_changes) {
+	// Compare against the commits as they were when the phase started.
+	// Commits are only ever added (removal just marks them skipped), so
+	// anything past the old count is new.
+	std::vector<uint64_t> cfp;
+	std::vector<size_t> ostart;
+	std::vector<uint32_t> ofp;
+	snapshot(s, cfp, ostart, ofp);
+	for (size_t i = 0; i < cfp.size(); i++) {
+	    size_t nops = ostart[i+1] - ostart[i];
+	    if (i >= commit_fp.size()) {
+		p.commits++;
+		p.ops += nops;
+		continue;
+	    }
+	    size_t oops = op_start[i+1] - op_start[i];
+	    size_t changed = std::max(nops, oops) - std::min(nops, oops);
+	    for (size_t j = 0; j < std::min(nops, oops); j++) {
+		if (ofp[ostart[i] + j] != op_fp[op_start[i] + j])
+		    changed++;
+	    }
+	    if (changed || cfp[i] != commit_fp[i])
+		p.commits++;
+	    p.ops += changed;
+	}
+	commit_fp.swap(cfp);
+	op_start.swap(ostart);
+	op_fp.swap(ofp);
+    }
+
+    phases.push_back(p);
+    mark();
+}
+
+template <typename K, typename V>
+static size_t
+mem_tree_heap(const std::pair<const K, V> &v)
+{
+    return fi_heap_size(v.first) + fi_heap_size(v.second);
+}
+
+static size_t
+mem_tree_heap(const std::string &v)
+{
+    return fi_heap_size(v);
+}
+
+// Memory held by the entries of a std::map or std::set - each is a tree
+// node of its own, with three links and a color ahead of the value.
+template <typename T>
+static size_t
+mem_tree(const T &t)
+{
+    size_t m = t.size() * (4 * sizeof(void *) + sizeof(typename T::value_type));
+    for (typename T::const_iterator t_it = t.begin(); t_it != t.end(); t_it++)
+	m += mem_tree_heap(*t_it);
+    return m;
+}
+
+template <typename T>
+static size_t
+mem_vec(const std::vector<T> &v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+// Add up what each of the data structures holds now, keeping it if it is
+// the most seen so far.  Text is all stored in the arena - the amounts in
+// use by the different kinds of text are listed as part of it.
+void
+fi_stats::mem_sample(git_fi_data *s, const char *name)
+{
+    std::vector<fi_mem_item> m;
+
+    size_t copied = 0;
+    for (size_t i = 0; i < s->blobs.size(); i++) {
+	if (s->blobs[i].cbuffer)
+	    copied += s->blobs[i].length;
+    }
+    m.push_back({"blobs", 0, mem_vec(s->blobs) + copied});
+    m.push_back({"copied blob contents", 1, copied});
+
+    size_t crecs = mem_vec(s->commits) + mem_vec(s->splice_commits) + mem_vec(s->splice_next);
+    size_t ops = 0, merges = 0, labels = 0;
+    size_t msgs = 0, rmsgs = 0, idents = 0, notes = 0;
+    for (size_t i = 0; i < s->commits.size() + s->splice_commits.size(); i++) {
+	const git_commit_data *c = s->commit_at(i);
+	ops += mem_vec(c->fileops);
+	merges += mem_vec(c->merges);
+	labels += mem_vec(c->svn_branches) + mem_vec(c->svn_tags) + mem_vec(c->cvs_branches);
+	msgs += c->commit_msg.length();
+	if (c->have_out_msg && c->out_msg.data() != c->commit_msg.data())
+	    rmsgs += c->out_msg.length();
+	idents += c->author.length() + c->author_timestamp.length() + c->committer.length() + c->committer_timestamp.length();
+	notes += c->notes_string.length();
+    }
+    m.push_back({"commits", 0, crecs + ops + merges + labels});
+    m.push_back({"records", 1, crecs});
+    m.push_back({"file operations", 1, ops});
+    m.push_back({"merges", 1, merges});
+    m.push_back({"svn/cvs label sets", 1, labels});
+
+    size_t tmsgs = 0;
+    for (size_t i = 0; i < s->tags.size(); i++)
+	tmsgs += s->tags[i].tag_msg.length() + s->tags[i].tagger.length() + s->tags[i].tagger_timestamp.length();
+    m.push_back({"tags", 0, mem_vec(s->tags)});
+
+    m.push_back({"text arena", 0, s->strings.mem_size()});
+    m.push_back({"commit messages", 1, msgs});
+    m.push_back({"rendered messages", 1, rmsgs});
+    m.push_back({"identities", 1, idents});
+    m.push_back({"notes", 1, notes});
+    m.push_back({"tag text", 1, tmsgs});
+
+    m.push_back({"paths", 0, s->paths.mem_size()});
+    m.push_back({"sha1_to_mark", 0, s->sha1_to_mark.mem_size()});
+    m.push_back({"mark_to_sha1", 0, s->mark_to_sha1.mem_size()});
+    m.push_back({"marks (index and remap)", 0, s->marks.mem_size()});
+    m.push_back({"children", 0, s->children.mem_size()});
+    m.push_back({"rev_to_sha1", 0, s->rev_to_sha1.mem_size()});
+    m.push_back({"sha12key", 0, s->sha12key.mem_size()});
+    m.push_back({"key2sha1", 0, s->key2sha1.mem_size()});
+    m.push_back({"key2cvsauthor", 0, mem_tree(s->key2cvsauthor)});
+    m.push_back({"key2cvsbranch", 0, mem_tree(s->key2cvsbranch)});
+    m.push_back({"email_map", 0, mem_tree(s->email_map)});
+    m.push_back({"blob_map", 0, s->blob_map.mem_size()});
+    m.push_back({"mode_map", 0, s->mode_map.mem_size()});
+    m.push_back({"svn_committer_map", 0, mem_tree(s->svn_committer_map)});
+    m.push_back({"rebuild/reset commits", 0, mem_tree(s->rebuild_commits) + mem_tree(s->reset_commits)});
+
+    size_t total = 0;
+    for (size_t i = 0; i < m.size(); i++) {
+	if (!m[i].depth)
+	    total += m[i].bytes;
+    }
+    if (mem_peak.size() && total < mem_peak_total)
+	return;
+    mem_peak.swap(m);
+    mem_peak_total = total;
+    mem_peak_phase = std::string(name);
+    mem_peak_commits = s->commits.size() + s->splice_commits.size();
+}
+
+void
+fi_stats::mem_report(std::ostream &out) const
+{
+    long peak = 0;
+    stats_cpu(&peak);
+
+    char line[256];
+    snprintf(line, sizeof(line), "Memory use at its largest (after %s):\n", mem_peak_phase.c_str());
+    out << line;
+    snprintf(line, sizeof(line), "%-28s %14s %10s\n", "structure", "bytes", "MB");
+    out << line;
+    for (size_t i = 0; i < mem_peak.size(); i++) {
+	std::string name = std::string(mem_peak[i].depth * 2, ' ') + std::string(mem_peak[i].name);
+	snprintf(line, sizeof(line), "%-28s %14zu %10.1f\n", name.c_str(), mem_peak[i].bytes, mem_peak[i].bytes / (1024.0 * 1024.0));
+	out << line;
+    }
+    snprintf(line, sizeof(line), "%-28s %14zu %10.1f\n", "total", mem_peak_total, mem_peak_total / (1024.0 * 1024.0));
+    out << line;
+    snprintf(line, sizeof(line), "%-28s %14zu %10.1f\n", "peak RSS", (size_t)peak * 1024, peak / 1024.0);
+    out << line;
+    if (mem_peak_commits) {
+	snprintf(line, sizeof(line), "%.0f bytes per commit", (double)mem_peak_total / mem_peak_commits);
+	out << line;
+	if (input_size) {
+	    snprintf(line, sizeof(line), ", %.2f MB per MB of input (peak RSS %.2f MB per MB)",
+		    (double)mem_peak_total / input_size, (double)peak * 1024 / input_size);
+	    out << line;
+	}
+	out << "\n";
+    }
+    out << "(Peak RSS includes any of the input file mapped into memory, which the\n";
+    out << "system can drop and read back as needed.)\n";
+}
+
+void
+fi_stats::report(std::ostream &out, bool json) const
+{
+    fi_phase t = {"total", 0, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < phases.size(); i++) {
+	t.wall += phases[i].wall;
+	t.cpu += phases[i].cpu;
+	t.rss_kb += phases[i].rss_kb;
+	t.commits += phases[i].commits;
+	t.ops += phases[i].ops;
+	t.bytes += phases[i].bytes;
+    }
+    long peak = 0;
+    stats_cpu(&peak);
+
+    char line[256];
+    if (json) {
+	// (Phase names are our own, so need no escaping)
+	out << "{\n  \"phases\": [\n";
+	for (size_t i = 0; i <= phases.size(); i++) {
+	    const fi_phase &p = (i < phases.size()) ? phases[i] : t;
+	    snprintf(line, sizeof(line), "{\"name\": \"%s\", \"wall_s\": %.6f, \"cpu_s\": %.6f, \"rss_delta_kb\": %ld, \"commits\": %zu, \"ops\": %zu, \"bytes\": %zu}",
+		    p.name.c_str(), p.wall, p.cpu, p.rss_kb, p.commits, p.ops, p.bytes);
+	    if (i < phases.size()) {
+		out << "    " << line << ((i + 1 < phases.size()) ? ",\n" : "\n");
+	    } else {
+		out << "  ],\n  \"total\": " << line << ",\n";
+	    }
+	}
+	out << "  \"peak_rss_kb\": " << peak << "\n}\n";
+	return;
+    }
+
+    snprintf(line, sizeof(line), "%-16s %9s %9s %12s %10s %10s %14s\n", "phase", "wall s", "cpu s", "peak RSS +MB", "commits", "ops", "bytes");
+    out << line;
+    for (size_t i = 0; i <= phases.size(); i++) {
+	const fi_phase &p = (i < phases.size()) ? phases[i] : t;
+	snprintf(line, sizeof(line), "%-16s %9.3f %9.3f %12.1f %10zu %10zu %14zu\n",
+		p.name.c_str(), p.wall, p.cpu, p.rss_kb / 1024.0, p.commits, p.ops, p.bytes);
+	out << line;
+    }
+    snprintf(line, sizeof(line), "peak RSS %.1f MB\n", peak / 1024.0);
+    out << line;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
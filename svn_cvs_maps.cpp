@@ -18,7 +18,7 @@
 #include "repowork.h"
 
 int
-git_map_svn_committers(git_fi_data *s, std::string &svn_map)
+read_svn_committer_map(git_fi_data *s, std::string &svn_map)
 {
     // read map
     std::ifstream infile(svn_map, std::ifstream::binary);
@@ -28,7 +28,6 @@ git_map_svn_committers(git_fi_data *s, std::string &svn_map)
     }
 
     // Create mapping of ids to svn committers 
-    std::map<std::string, std::string> svn_committer_map;
     std::string line;
     while (std::getline(infile, line)) {
 	// Skip empty lines
@@ -45,20 +44,34 @@ git_map_svn_committers(git_fi_data *s, std::string &svn_map)
 	std::string id = line.substr(0, spos);
 	std::string committer = line.substr(spos+1, std::string::npos);
 
-	svn_committer_map[id] = committer;
+	s->svn_committer_map[id] = committer;
+    }
+
+    return 0;
+}
+
+void
+commit_map_svn_committer(git_commit_data *c)
+{
+    if (!c->svn_id.length()) {
+	return;
     }
+    std::map<std::string, std::string, std::less<>> &svn_committer_map = c->s->svn_committer_map;
+    std::map<std::string, std::string, std::less<>>::iterator s_it = svn_committer_map.find(c->svn_id);
+    if (s_it != svn_committer_map.end()) {
+	//std::cerr << "Found SVN commit \"" << c->svn_id << "\" with committer \"" << s_it->second << "\"\n";
+	c->svn_committer = s_it->second;
+    }
+}
+
+int
+git_map_svn_committers(git_fi_data *s, std::string &svn_map)
+{
+    read_svn_committer_map(s, svn_map);
 
     // Iterate over the commits and assign committers.
     for (size_t i = 0; i < s->commits.size(); i++) {
-	git_commit_data *c = &(s->commits[i]);
-	if (!c->svn_id.length()) {
-	    continue;
-	}
-	if (svn_committer_map.find(c->svn_id) != svn_committer_map.end()) {
-	    std::string svncommitter = svn_committer_map[c->svn_id];
-	    //std::cerr << "Found SVN commit \"" << c->svn_id << "\" with committer \"" << svncommitter << "\"\n";
-	    c->svn_committer = svncommitter;
-	}
+	commit_map_svn_committer(&s->commits[i]);
     }
 
     return 0;
@@ -78,8 +91,13 @@ read_key_sha1_map(git_fi_data *s, std::string &keysha1file)
         size_t cpos = line.find_first_of(":");
         std::string key = line.substr(0, cpos);
         std::string sha1 = line.substr(cpos+1, std::string::npos);
-	s->sha12key[sha1] = key;
-	s->key2sha1[key] = sha1;
+	git_oid oid;
+	if (cpos == std::string::npos || !oid.from_hex(sha1)) {
+	    std::cerr << "Warning - skipping key map line with an invalid sha1: " << line << "\n";
+	    continue;
+	}
+	s->sha12key.insert(oid, key);
+	s->key2sha1.insert(key, oid);
     }
     infile.close();
 }
@@ -107,7 +125,7 @@ read_key_cvsbranch_map(
                 std::cout << "WARNING: non-unique key maps to both branch " << oldbranch << " and branch "  << branch << ", overriding\n";
             }
         }
-	if (s->key2sha1.find(key) != s->key2sha1.end()) {
+	if (s->key2sha1.find(key)) {
 	    s->key2cvsbranch[key] = branch;
 	}
     }
@@ -135,7 +153,7 @@ read_key_cvsauthor_map(	git_fi_data *s, std::string &authorfile)
                 std::cout << "WARNING: non-unique key maps to both author " << oldauthor << " and author "  << author << ", overriding\n";
             }
         }
-	if (s->key2sha1.find(key) != s->key2sha1.end()) {
+	if (s->key2sha1.find(key)) {
 	    s->key2cvsauthor[key] = author;
 	}
     }
@@ -13,6 +13,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <iterator>
 #include <locale>
 
 #include "repowork.h"
@@ -29,55 +31,81 @@ struct schars: std::ctype<char> {
     }
 };
 
+// The std::getline equivalent for walking a message held in a string view -
+// returns false once the message is used up.
+static bool
+msg_getline(std::string_view &msg, std::string_view &line)
+{
+    if (!msg.length()) {
+	return false;
+    }
+    size_t epos = msg.find('\n');
+    line = msg.substr(0, epos);
+    msg.remove_prefix((epos == std::string::npos) ? msg.length() : epos + 1);
+    return true;
+}
+
+// Check for a "svn:"/"cvs:" info line.  This is equivalent to a full match of
+// the line against "^prefix.*" - in particular, as with the regex '.', a line
+// holding a carriage return doesn't qualify.
+static bool
+msg_info_line(std::string_view line, std::string_view prefix)
+{
+    if (line.length() < prefix.length() || line.compare(0, prefix.length(), prefix) != 0) {
+	return false;
+    }
+    return (line.find('\r') == std::string::npos);
+}
+
+// The info values are views into str, so str must be arena or map storage
+// that outlives the commit.
 void
-parse_cvs_svn_info(git_commit_data *c, std::string &str)
+parse_cvs_svn_info(git_commit_data *c, std::string_view str)
 {
-    std::stringstream ss(str);
-    std::string cline;
-    std::regex svnrevline("^svn:revision:([0-9]+).*");
-    std::regex svnbranchline("^svn:branch:(.*)");
-    std::regex svntagline("^svn:tag:(.*)");
-    std::regex svncommitterline("^svn:account:(.*)");
-    std::regex cvsbranchline("^cvs:branch:(.*)");
-    std::regex cvscommitterline("^cvs:account:(.*)");
+    std::string_view msg(str);
+    std::string_view cline;
 
     c->svn_branches.clear();
     c->cvs_branches.clear();
 
-    while (std::getline(ss, cline, '\n')) {
-	if (std::regex_match(cline, svnrevline)) {
+    while (msg_getline(msg, cline)) {
+	// Cheap check to skip the (many) lines that can't be info lines
+	if (cline.length() < 4 || cline[3] != ':') {
+	    continue;
+	}
+	if (msg_info_line(cline, "svn:revision:") && cline.length() > 13 && cline[13] >= '0' && cline[13] <= '9') {
 	    c->svn_id = cline.substr(13, std::string::npos);
 	    continue;
 	}
-	if (std::regex_match(cline, svnbranchline)) {
-	    std::string nbranch = cline.substr(11, std::string::npos);
-	    if (nbranch == std::string("master")) {
-		nbranch = std::string("trunk");
+	if (msg_info_line(cline, "svn:branch:")) {
+	    std::string_view nbranch(cline.substr(11, std::string::npos));
+	    if (nbranch == "master") {
+		nbranch = "trunk";
 	    }
-	    c->svn_branches.insert(nbranch);
+	    fi_label_insert(c->svn_branches, nbranch);
 	    continue;
 	}
-	if (std::regex_match(cline, svntagline)) {
-	    std::string ntag = cline.substr(8, std::string::npos);
-	    if (ntag == std::string("master")) {
-		ntag = std::string("trunk");
+	if (msg_info_line(cline, "svn:tag:")) {
+	    std::string_view ntag(cline.substr(8, std::string::npos));
+	    if (ntag == "master") {
+		ntag = "trunk";
 	    }
-	    c->svn_tags.insert(ntag);
+	    fi_label_insert(c->svn_tags, ntag);
 	    continue;
 	}
-	if (std::regex_match(cline, svncommitterline)) {
+	if (msg_info_line(cline, "svn:account:")) {
 	    c->svn_committer = cline.substr(12, std::string::npos);
 	    continue;
 	}
-	if (std::regex_match(cline, cvsbranchline)) {
-	    std::string nbranch = cline.substr(11, std::string::npos);
-	    if (nbranch == std::string("master")) {
-		nbranch = std::string("trunk");
+	if (msg_info_line(cline, "cvs:branch:")) {
+	    std::string_view nbranch(cline.substr(11, std::string::npos));
+	    if (nbranch == "master") {
+		nbranch = "trunk";
 	    }
-	    c->cvs_branches.insert(nbranch);
+	    fi_label_insert(c->cvs_branches, nbranch);
 	    continue;
 	}
-	if (std::regex_match(cline, cvscommitterline)) {
+	if (msg_info_line(cline, "cvs:account:")) {
 	    c->cvs_committer = cline.substr(12, std::string::npos);
 	    continue;
 	}
@@ -88,15 +116,13 @@ void
 update_commit_msg(git_commit_data *c)
 {
     // First, get a version of the commit message without any svn or cvs info.
-    std::set<std::string>::iterator s_it;
-    std::regex cvsline("^cvs:.*");
-    std::regex svnline("^svn:.*");
-    std::string cline;
+    fi_label_set::iterator s_it;
+    std::string_view cline;
     std::string nmsg;
-    std::stringstream css(c->commit_msg);
-    while (std::getline(css, cline, '\n')) {
-	bool smatch = std::regex_match(cline, svnline);
-	bool cmatch = std::regex_match(cline, cvsline);
+    std::string_view msg(c->commit_msg);
+    while (msg_getline(msg, cline)) {
+	bool smatch = msg_info_line(cline, "svn:");
+	bool cmatch = msg_info_line(cline, "cvs:");
 	if (smatch || cmatch) {
 	    // If we do already have CVS/SVN info, don't write the last blank
 	    // spacer line - it was inserted to separate it from the actual
@@ -109,43 +135,43 @@ update_commit_msg(git_commit_data *c)
     }
 
     // If we have any SVN or CVS info, insert a blank line:
-    if ((c->svn_id.length() && c->svn_id != std::string("-1")) || c->svn_branches.size() || c->svn_tags.size() || c->svn_committer.length() || c->cvs_branches.size() || c->cvs_committer.length() ) {
+    if ((c->svn_id.length() && c->svn_id != "-1") || c->svn_branches.size() || c->svn_tags.size() || c->svn_committer.length() || c->cvs_branches.size() || c->cvs_committer.length() ) {
 	nmsg.append("\n");
     }
 
     // Add all the info we have
-    if (c->svn_id.length() && c->svn_id != std::string("-1")) {
-	std::string ninfo = std::string("svn:revision:") + c->svn_id;
+    if (c->svn_id.length() && c->svn_id != "-1") {
+	std::string ninfo = std::string("svn:revision:") + std::string(c->svn_id);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
     for (s_it = c->svn_branches.begin(); s_it != c->svn_branches.end(); s_it++) {
-	std::string ninfo = std::string("svn:branch:") + *s_it;
+	std::string ninfo = std::string("svn:branch:") + std::string(*s_it);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
     for (s_it = c->svn_tags.begin(); s_it != c->svn_tags.end(); s_it++) {
-	std::string ninfo = std::string("svn:tag:") + *s_it;
+	std::string ninfo = std::string("svn:tag:") + std::string(*s_it);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
     if (c->svn_committer.length()) {
-	std::string ninfo = std::string("svn:account:") + c->svn_committer;
+	std::string ninfo = std::string("svn:account:") + std::string(c->svn_committer);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
     for (s_it = c->cvs_branches.begin(); s_it != c->cvs_branches.end(); s_it++) {
-	std::string ninfo = std::string("cvs:branch:") + *s_it;
+	std::string ninfo = std::string("cvs:branch:") + std::string(*s_it);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
     if (c->cvs_committer.length()) {
-	std::string ninfo = std::string("cvs:account:") + c->cvs_committer;
+	std::string ninfo = std::string("cvs:account:") + std::string(c->cvs_committer);
 	nmsg.append(ninfo);
 	nmsg.append("\n");
     }
 
-    c->commit_msg = nmsg;
+    c->commit_msg = c->s->store(nmsg);
 }
 
 
@@ -189,21 +215,22 @@ git_update_svn_revs(git_fi_data *s, std::string &svn_rev_map)
 
     for (size_t i = 0; i < s->commits.size(); i++) {
 
-	if (!s->commits[i].id.sha1.length()) {
+	if (s->commits[i].id.sha1.is_null()) {
 	    continue;
 	}
-	if (rmap.find(s->commits[i].id.sha1) == rmap.end()) {
+	std::string sha1 = s->commits[i].id.sha1.hex();
+	if (rmap.find(sha1) == rmap.end()) {
 	    continue;
 	}
 
-	long nrev =  rmap[s->commits[i].id.sha1];
-	s->commits[i].svn_id = std::to_string(nrev);
+	long nrev =  rmap[sha1];
+	s->commits[i].svn_id = s->store(std::to_string(nrev));
 
 	if (nrev > 0) {
 	    std::cout << "Assigning new SVN rev " << nrev << " to " << s->commits[i].id.sha1 << "\n";
 	    // Note:  this isn't guaranteed to be unique...  setting it mostly for
 	    // the cases where it is.
-	    s->rev_to_sha1[s->commits[i].svn_id] = s->commits[i].id.sha1;
+	    s->rev_to_sha1.insert(std::string(s->commits[i].svn_id), s->commits[i].id.sha1);
 	    update_commit_msg(&s->commits[i]);
 	}
 
@@ -234,7 +261,8 @@ git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update
 	std::cerr << "Could not open svn_branch_map file: " << svn_branch_map << "\n";
 	exit(-1);
     }
-    std::map<std::string, std::set<std::string>> bmap;
+    // Branch names are stored in the arena, so the commits can use them
+    std::map<std::string, fi_label_set, std::less<>> bmap;
     if (infile_branches.good()) {
 	std::string line;
 	while (std::getline(infile_branches, line)) {
@@ -267,7 +295,7 @@ git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update
 	    std::vector<std::string> branches_array(b_begin, b_end);
 	    std::copy(branches_array.begin(), branches_array.end(), std::ostream_iterator<std::string>(oss, "\n"));
 	    for (size_t i = 0; i < branches_array.size(); i++) {
-		bmap[id1].insert(branches_array[i]);
+		fi_label_insert(bmap[id1], s->store(branches_array[i]));
 	    }
 	}
 
@@ -278,7 +306,7 @@ git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update
     for (size_t i = 0; i < s->commits.size(); i++) {
 	long int rev = -1;
 	if (s->commits[i].svn_id.length()) {
-	    rev = std::stol(s->commits[i].svn_id);
+	    rev = fi_stol(s->commits[i].svn_id);
 	}
 	if (update_mode == 0 && s->commits[i].svn_id.length()) {
 	    // If we're in overwrite mode, don't go beyond the CVS era commits - 
@@ -290,13 +318,14 @@ git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update
 	    }
 	}
 
-	std::set<std::string> sbranches;
+	fi_label_set sbranches;
 	if (key_type == 1) {
-	    if (update_mode == 1 && !s->commits[i].id.sha1.length())
+	    if (update_mode == 1 && s->commits[i].id.sha1.is_null())
 		continue;
-	    if (update_mode == 1 && bmap.find(s->commits[i].id.sha1) == bmap.end())
+	    std::string sha1 = (s->commits[i].id.sha1.is_null()) ? std::string() : s->commits[i].id.sha1.hex();
+	    if (update_mode == 1 && bmap.find(sha1) == bmap.end())
 		continue;
-	    sbranches = bmap[s->commits[i].id.sha1];
+	    sbranches = bmap[sha1];
 	}
 
 	if (key_type == 2) {
@@ -304,7 +333,7 @@ git_assign_branch_labels(git_fi_data *s, std::string &svn_branch_map, int update
 		continue;
 	    if (update_mode == 1 && bmap.find(s->commits[i].svn_id) == bmap.end())
 		continue;
-	    sbranches = bmap[s->commits[i].svn_id];
+	    sbranches = bmap[std::string(s->commits[i].svn_id)];
 	}
 
 	if (rev > 29886) {
@@ -344,11 +373,12 @@ git_set_tag_labels(git_fi_data *s, std::string &tag_list)
 		continue;
 	    tag_sha1s.insert(line);
 	    std::cout << "tag sha1: " << line << "\n";
-	    bool valid = (s->sha1_to_mark.find(line) != s->sha1_to_mark.end());
-	    if (!valid) {
+	    long *tmark = s->sha1_to_mark.find(git_oid(line));
+	    if (!tmark) {
 		std::cout << "INVALID sha1 supplied for tag!\n";
+		continue;
 	    }
-	    git_commit_data &c = s->commits[s->mark_to_index[s->sha1_to_mark[line]]];
+	    git_commit_data &c = s->commits[s->marks.index(*tmark)];
 	    c.svn_tags = c.svn_branches;
 	    c.svn_branches.clear();
 	    update_commit_msg(&c);
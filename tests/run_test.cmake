@@ -0,0 +1,29 @@
+# Run repowork on a test case's input.fi and compare the output with its
+# expected.fi.  Used by the tests in CMakeLists.txt:
+#
+#   cmake -DREPOWORK=<repowork> -DCASE_DIR=<test case> -DOUTPUT=<file> -DARGS=<options> -P run_test.cmake
+
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+execute_process(
+  COMMAND ${REPOWORK} ${args} ${CASE_DIR}/input.fi ${OUTPUT}
+  RESULT_VARIABLE ret
+  OUTPUT_QUIET
+  )
+if (ret)
+  message(FATAL_ERROR "repowork failed: ${ret}")
+endif (ret)
+
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${CASE_DIR}/expected.fi
+  RESULT_VARIABLE ret
+  )
+if (ret)
+  message(FATAL_ERROR "${OUTPUT} differs from ${CASE_DIR}/expected.fi")
+endif (ret)
+
+# Local Variables:
+# tab-width: 8
+# mode: cmake
+# indent-tabs-mode: t
+# End:
+# ex: shiftwidth=2 tabstop=8
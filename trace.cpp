@@ -0,0 +1,124 @@
+/*                      T R A C E . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file trace.cpp
+ *
+ * Timeline recording (--trace).  Spans are collected in memory as the run
+ * goes and written out at the end in the Chrome trace event format, which
+ * Perfetto (ui.perfetto.dev) and chrome://tracing can both display.
+ *
+ */
+
+#include <cstdio>
+
+#include "repowork.h"
+
+fi_trace fi_tracer;
+
+thread_local int fi_thread_slot = 0;
+
+int
+fi_trace::open(const std::string &path)
+{
+    ofile = path;
+    events.clear();
+    t0 = std::chrono::steady_clock::now();
+    on = true;
+    return 0;
+}
+
+uint64_t
+fi_trace::us(std::chrono::steady_clock::time_point t) const
+{
+    if (t < t0)
+	return 0;
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - t0).count();
+}
+
+void
+fi_trace::add(const char *name, uint64_t start, uint64_t end, const std::string &detail)
+{
+    std::lock_guard<std::mutex> lock(events_lock);
+    events.push_back({name, detail, start, (end > start) ? end - start : 0, fi_thread_slot});
+}
+
+static void
+trace_quote(FILE *fp, std::string_view s)
+{
+    fputc('"', fp);
+    for (size_t i = 0; i < s.length(); i++) {
+	unsigned char c = s[i];
+	if (c == '"' || c == '\\') {
+	    fputc('\\', fp);
+	    fputc(c, fp);
+	} else if (c < 0x20) {
+	    fprintf(fp, "\\u%04x", c);
+	} else {
+	    fputc(c, fp);
+	}
+    }
+    fputc('"', fp);
+}
+
+int
+fi_trace::close()
+{
+    if (!on)
+	return 0;
+    on = false;
+
+    FILE *fp = fopen(ofile.c_str(), "wb");
+    if (!fp) {
+	std::cerr << "Could not open trace file: " << ofile << "\n";
+	return -1;
+    }
+
+    // Name the threads - slot 0 is the main thread, and the others are the
+    // worker threads of whichever parallel loop was running at the time
+    std::set<int> slots;
+    for (size_t i = 0; i < events.size(); i++)
+	slots.insert(events[i].tid);
+    slots.insert(0);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"repowork\"}}");
+    for (std::set<int>::iterator s_it = slots.begin(); s_it != slots.end(); s_it++) {
+	std::string tname = (*s_it) ? std::string("worker ") + std::to_string(*s_it) : std::string("main");
+	fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", *s_it, tname.c_str());
+	fprintf(fp, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"sort_index\": %d}}", *s_it, *s_it);
+    }
+
+    for (size_t i = 0; i < events.size(); i++) {
+	const trace_event &e = events[i];
+	fprintf(fp, ",\n{\"name\": ");
+	trace_quote(fp, e.name);
+	fprintf(fp, ", \"cat\": \"repowork\", \"ph\": \"X\", \"ts\": %llu, \"dur\": %llu, \"pid\": 1, \"tid\": %d",
+		(unsigned long long)e.ts, (unsigned long long)e.dur, e.tid);
+	if (e.detail.length()) {
+	    fprintf(fp, ", \"args\": {\"detail\": ");
+	    trace_quote(fp, e.detail);
+	    fputc('}', fp);
+	}
+	fputc('}', fp);
+    }
+    fprintf(fp, "\n]}\n");
+    events.clear();
+
+    if (fclose(fp)) {
+	std::cerr << "Error writing trace file: " << ofile << "\n";
+	return -1;
+    }
+    return 0;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8
@@ -13,6 +13,8 @@
 
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <iterator>
 #include <locale>
 
 #include "repowork.h"
@@ -29,39 +31,97 @@ struct schars: std::ctype<char> {
     }
 };
 
+// Read a commit reference (a mark or an original SHA1) from the input.  For
+// the main data it is translated straight away - in a staging git_fi_data the
+// input mark or SHA1 is held until git_resolve_commitish is run on the merge.
 int
-git_parse_commitish(git_commitish &gc, git_fi_data *s, std::string line)
+git_parse_commitish(git_commitish &gc, git_fi_data *s, std::string_view line)
 {
-       if (line.c_str()[0] == ':') {
-        // If we start with a colon, we have a mark - translate it and zero
-        // from_str.
-        line.erase(0, 1); // Remove ":" prefix
-	long omark = std::stol(line);
-        gc.mark = s->mark_old_to_new[omark];
-	if (s->mark_to_index.find(gc.mark) != s->mark_to_index.end()) {
-	    gc.index = s->mark_to_index[gc.mark];
-	    //std::cout << "Mark id :" << line << " -> " << gc.index << "\n";
-	} else {
-	    std::cerr << "Mark with no index:" << gc.mark << "\n";
-	    exit(EXIT_FAILURE);
-	}
-        return 0;
+    if (line.length() && line[0] == ':') {
+        // If we start with a colon, we have a mark
+        line.remove_prefix(1); // Remove ":" prefix
+	gc.mark = fi_stol(line);
+	return (s->staging) ? 0 : git_resolve_commitish(gc, s);
     }
     if (!ficmp(line, std::string("refs/heads/"))) {
-        gc.ref = std::stol(line);
+	// Branch references aren't tracked
         return 0;
     }
     if (line.length() == 40) {
         // Probably have a SHA1
-        gc.sha1 = line;
-        gc.index = s->mark_to_index[s->sha1_to_mark[gc.sha1]];
-        //std::cout << "SHA1 id :" << gc.sha1 << " -> " << gc.mark << " -> " << gc.index << "\n";
-        return 0;
+        gc.sha1 = git_oid(line);
+	return (s->staging) ? 0 : git_resolve_commitish(gc, s);
     }
 
     return -1;
 }
 
+// Translate a reference as read from the input - gc.mark is the input
+// mark, or if there isn't one gc.sha1 is the original SHA1 - to the
+// output mark and object index.
+int
+git_resolve_commitish(git_commitish &gc, git_fi_data *s)
+{
+    if (gc.mark != -1) {
+	long omark = gc.mark;
+	gc.mark = s->marks.remap(omark);
+	if (gc.mark == -1) {
+	    std::cerr << "Reference to unknown mark :" << omark << "\n";
+	    exit(EXIT_FAILURE);
+	}
+	gc.index = s->marks.index(gc.mark);
+	if (gc.index == -1) {
+	    std::cerr << "Mark with no index:" << gc.mark << "\n";
+	    exit(EXIT_FAILURE);
+	}
+	//std::cout << "Mark id :" << omark << " -> " << gc.index << "\n";
+	return 0;
+    }
+    if (!gc.sha1.is_null()) {
+	long *smark = s->sha1_to_mark.find(gc.sha1);
+	if (smark) {
+	    gc.mark = *smark;
+	    gc.index = s->marks.index(*smark);
+	}
+        //std::cout << "SHA1 id :" << gc.sha1 << " -> " << gc.mark << " -> " << gc.index << "\n";
+    }
+    return 0;
+}
+
+// Index of the commit with original sha1 oid, or -1 if there isn't one
+static long
+commit_index(git_fi_data *s, const git_oid &oid)
+{
+    const long *cmark = s->sha1_to_mark.find(oid);
+    if (!cmark || s->marks.type(*cmark) != mark_commit)
+	return -1;
+    return s->marks.index(*cmark);
+}
+
+// Nearest surviving ancestor of the removed commit r.  Each chain of
+// removed commits is only walked once - everything on it remembers the
+// answer.
+static git_commitish
+removal_target(git_fi_data *s, long r, fi_hashmap<long, git_commitish> &targets)
+{
+    std::vector<long> chain;
+    chain.push_back(r);
+    git_commitish t = s->commits[r].from;
+    while (t.index >= 0 && t.index < (long)s->commits.size() && s->commits[t.index].skip_commit) {
+	const git_commitish *known = targets.find(t.index);
+	if (known) {
+	    t = *known;
+	    break;
+	}
+	chain.push_back(t.index);
+	t = s->commits[t.index].from;
+    }
+    for (size_t i = 0; i < chain.size(); i++) {
+	targets.insert(chain[i], t);
+    }
+    return t;
+}
+
 int
 git_remove_commits(git_fi_data *s, std::string &remove_commits)
 {
@@ -85,14 +145,7 @@ git_remove_commits(git_fi_data *s, std::string &remove_commits)
 	    }
 	    remove_sha1s.insert(line);
 	    std::cout << "remove sha1: " << line << "\n";
-	    bool valid = false;
-	    for (size_t i = 0; i < s->commits.size(); i++) {
-		if (s->commits[i].id.sha1 == line) {
-		    valid = true;
-		    break;
-		}
-	    }
-	    if (!valid) {
+	    if (commit_index(s, git_oid(line)) < 0) {
 		std::cout << "INVALID sha1 supplied for removal!\n";
 	    }
 	}
@@ -100,29 +153,41 @@ git_remove_commits(git_fi_data *s, std::string &remove_commits)
 	infile_remove_commits.close();
     }
 
-
+    // Flag everything being removed first, so chains of removed commits
+    // can be resolved to the nearest surviving ancestor in one go.  The
+    // references to update are found with the children index.
+    std::vector<std::pair<std::string, long>> removed;
     std::set<std::string>::iterator r_it;
     for (r_it = remove_sha1s.begin(); r_it != remove_sha1s.end(); r_it++) {
-	git_commitish rfrom;
-	git_commitish rish;
-	for (size_t i = 0; i < s->commits.size(); i++) {
-	    if (s->commits[i].id.sha1 == *r_it) {
-		rfrom = s->commits[i].from;
-		rish = s->commits[i].id;
-		s->commits[i].skip_commit = true;
-		break;
-	    }
-	}
+	long rind = commit_index(s, git_oid(*r_it));
+	if (rind < 0)
+	    continue;
+	s->commits[rind].skip_commit = true;
+	removed.push_back(std::make_pair(*r_it, rind));
+    }
+    if (!removed.size())
+	return 0;
+
+    fi_hashmap<long, git_commitish> targets;
+    for (size_t i = 0; i < removed.size(); i++) {
+	long rind = removed[i].second;
+	git_commitish rfrom = removal_target(s, rind, targets);
+
 	// Update any references
-	for (size_t i = 0; i < s->commits.size(); i++) {
-	    if (s->commits[i].from == rish) {
-		std::cout << *r_it << " removal: updating from commit for " << s->commits[i].id.sha1 << "\n";
-		s->commits[i].from = rfrom;
+	for (long ci : s->children.of(rind)) {
+	    if (ci >= (long)s->commits.size())
+		continue;
+	    git_commit_data &c = s->commits[ci];
+	    if (c.from.index == rind) {
+		std::cout << removed[i].first << " removal: updating from commit for " << c.id.sha1 << "\n";
+		c.from = rfrom;
+		s->children.link(rfrom.index, ci);
 	    }
-	    for (size_t j = 0; j < s->commits[i].merges.size(); j++) {
-		if (s->commits[i].merges[j] == rish) {
-		    std::cout << *r_it << " removal: updating merge commit for " << s->commits[i].id.sha1 << "\n";
-		    s->commits[i].merges[j] = rfrom;
+	    for (size_t k = 0; k < c.merges.size(); k++) {
+		if (c.merges[k].index == rind) {
+		    std::cout << removed[i].first << " removal: updating merge commit for " << c.id.sha1 << "\n";
+		    c.merges[k] = rfrom;
+		    s->children.link(rfrom.index, ci);
 		}
 	    }
 	}
@@ -132,7 +197,7 @@ git_remove_commits(git_fi_data *s, std::string &remove_commits)
 }
 
 int
-git_map_emails(git_fi_data *s, std::string &email_map)
+read_email_map(git_fi_data *s, std::string &email_map)
 {
     // read map
     std::ifstream infile(email_map, std::ifstream::binary);
@@ -141,8 +206,6 @@ git_map_emails(git_fi_data *s, std::string &email_map)
 	exit(-1);
     }
 
-    std::map<std::string, std::string> email_id_map;
-
     std::string line;
     while (std::getline(infile, line)) {
 	// Skip empty lines
@@ -161,30 +224,43 @@ git_map_emails(git_fi_data *s, std::string &email_map)
 
 	std::cout << "id1: \"" << id1 << "\"\n";
 	std::cout << "id2: \"" << id2 << "\"\n";
-	email_id_map[id1] = id2;
+	s->email_map[id1] = id2;
+    }
+
+    return 0;
+}
+
+void
+commit_map_emails(git_commit_data *c)
+{
+    std::map<std::string, std::string, std::less<>> &email_id_map = c->s->email_map;
+    std::map<std::string, std::string, std::less<>>::iterator e_it;
+    e_it = email_id_map.find(c->author);
+    if (e_it != email_id_map.end()) {
+	c->author = e_it->second;
+    }
+    e_it = email_id_map.find(c->committer);
+    if (e_it != email_id_map.end()) {
+	//std::cerr << "Replaced committer \"" << c->committer << "\" with \"" << e_it->second << "\"\n";
+	c->committer = e_it->second;
     }
+}
 
-    // Iterate over the commits looking for note commits.  If we find one,
-    // find its associated blob with data, read it, find the associated
-    // commit, and stash it in a string in that container.
+int
+git_map_emails(git_fi_data *s, std::string &email_map)
+{
+    read_email_map(s, email_map);
+
+    // Iterate over the commits, replacing any ids found in the map
     for (size_t i = 0; i < s->commits.size(); i++) {
-	git_commit_data *c = &(s->commits[i]);
-	if (email_id_map.find(c->author) != email_id_map.end()) {
-	    std::string nauthor = email_id_map[c->author];
-	    c->author = nauthor;
-	}
-	if (email_id_map.find(c->committer) != email_id_map.end()) {
-	    std::string ncommitter = email_id_map[c->committer];
-	    //std::cerr << "Replaced committer \"" << c->committer << "\" with \"" << ncommitter << "\"\n";
-	    c->committer = ncommitter;
-	}
+	commit_map_emails(&s->commits[i]);
     }
 
     return 0;
 }
 
 int
-git_map_blobs(git_fi_data *s, std::string &blob_map_file)
+read_blob_map(git_fi_data *s, std::string &blob_map_file)
 {
     // read map
     std::ifstream infile(blob_map_file, std::ifstream::binary);
@@ -193,8 +269,6 @@ git_map_blobs(git_fi_data *s, std::string &blob_map_file)
 	exit(-1);
     }
 
-    std::map<std::string, std::string> blob_map;
-
     std::string line;
     while (std::getline(infile, line)) {
 	// Skip empty lines
@@ -213,45 +287,67 @@ git_map_blobs(git_fi_data *s, std::string &blob_map_file)
 
 	std::cout << "id1: \"" << id1 << "\"\n";
 	std::cout << "id2: \"" << id2 << "\"\n";
-	blob_map[id1] = id2;
+	git_oid oid1(id1);
+	git_oid oid2(id2);
+	if (oid1.is_null() || oid2.is_null()) {
+	    std::cerr << "Invalid blob map line!: " << line << "\n";
+	    exit(-1);
+	}
+	s->blob_map.insert(oid1, oid2);
     }
 
-    // Make sure we have all the assigned SHA1s we know about
-    for (size_t i = 0; i < s->commits.size(); i++) {
-	git_commit_data *c = &(s->commits[i]);
-	for (size_t i = 0; i < c->fileops.size(); i++) {
-	    git_op &o = c->fileops[i];
-	    if (!o.dataref.sha1.length()) {
-		if (s->mark_to_sha1.find(o.dataref.mark) != s->mark_to_sha1.end()) {
-		    o.dataref.sha1 = s->mark_to_sha1[o.dataref.mark];
-		}
+    return 0;
+}
+
+void
+commit_map_blobs(git_commit_data *c)
+{
+    git_fi_data *s = c->s;
+    for (size_t i = 0; i < c->fileops.size(); i++) {
+	git_op &o = c->fileops[i];
+
+	// Make sure we have all the assigned SHA1s we know about
+	if (o.dataref.sha1.is_null()) {
+	    const git_oid *oid = s->mark_to_sha1.find(o.dataref.mark);
+	    if (oid) {
+		o.dataref.sha1 = *oid;
 	    }
 	}
-    }
 
-    // Iterate over the commits looking for blobs in the map.  If we find one,
-    // associate it with the new blob.
-    for (size_t i = 0; i < s->commits.size(); i++) {
-	git_commit_data *c = &(s->commits[i]);
-	for (size_t i = 0; i < c->fileops.size(); i++) {
-	    git_op &o = c->fileops[i];
-	    if (!o.dataref.sha1.length())
+	// If the blob is in the map, associate the op with the new blob.
+	if (o.dataref.sha1.is_null())
+	    continue;
+	const git_oid *nsha1 = s->blob_map.find(o.dataref.sha1);
+	if (nsha1) {
+	    std::cout << "Mapping " << o.dataref.sha1 << " to " << *nsha1 << "\n";
+	    o.dataref.sha1 = *nsha1;
+	    long *bmark = s->sha1_to_mark.find(o.dataref.sha1);
+	    if (!bmark) {
+		// When streaming, replacement blobs have to show up in the
+		// input before the commits that use them.
+		std::cerr << "Warning - replacement blob " << o.dataref.sha1 << " has not been seen in the input\n";
 		continue;
-	    if (blob_map.find(o.dataref.sha1) != blob_map.end()) {
-		std::cout << "Mapping " << o.dataref.sha1 << " to " << blob_map[o.dataref.sha1] << "\n";
-		std::string oref = o.dataref.sha1;
-		o.dataref.sha1 = blob_map[oref];
-		o.dataref.mark = s->sha1_to_mark[o.dataref.sha1];
-		o.dataref.index = s->mark_to_index[o.dataref.mark];
 	    }
+	    o.dataref.mark = *bmark;
 	}
     }
+}
+
+int
+git_map_blobs(git_fi_data *s, std::string &blob_map_file)
+{
+    read_blob_map(s, blob_map_file);
+
+    // Iterate over the commits looking for blobs in the map.
+    for (size_t i = 0; i < s->commits.size(); i++) {
+	commit_map_blobs(&s->commits[i]);
+    }
 
     return 0;
 }
 
 int
-git_map_modes(git_fi_data *s, std::string &mode_map_file)
+read_mode_map(git_fi_data *s, std::string &mode_map_file)
 {
     // read map
     std::ifstream infile(mode_map_file, std::ifstream::binary);
@@ -260,8 +356,6 @@ git_map_modes(git_fi_data *s, std::string &mode_map_file)
 	exit(-1);
     }
 
-    std::map<std::string, std::string> mode_map;
-
     std::string line;
     while (std::getline(infile, line)) {
 	// Skip empty lines
@@ -280,22 +374,43 @@ git_map_modes(git_fi_data *s, std::string &mode_map_file)
 
 	std::cout << "id1: \"" << id1 << "\"\n";
 	std::cout << "id2: \"" << id2 << "\"\n";
-	mode_map[id2] = id1;
+	git_mode_t mode = git_mode_parse(id1);
+	if (mode == mode_none) {
+	    std::cerr << "Unsupported file mode in mode map: " << line << "\n";
+	    exit(-1);
+	}
+	s->mode_map.insert(s->paths.intern(id2), mode);
     }
 
+    return 0;
+}
+
+void
+commit_map_modes(git_commit_data *c)
+{
+    // Paths are interned, so this is an integer lookup per op
+    fi_hashmap<uint32_t, git_mode_t> &mode_map = c->s->mode_map;
+    for (size_t i = 0; i < c->fileops.size(); i++) {
+	git_op &o = c->fileops[i];
+	if (o.mode == mode_none || !o.path)
+	    continue;
+	const git_mode_t *nmode = mode_map.find(o.path);
+	if (nmode) {
+	    std::cout << "Setting mode of " << c->s->paths.str(o.path) << " to " << git_mode_str(*nmode) << "\n";
+	    o.mode = *nmode;
+	}
+    }
+}
+
+int
+git_map_modes(git_fi_data *s, std::string &mode_map_file)
+{
+    read_mode_map(s, mode_map_file);
+
     // Iterate over the commits looking for paths in the map.  If we find one,
     // associate it with the new mode.
     for (size_t i = 0; i < s->commits.size(); i++) {
-	git_commit_data *c = &(s->commits[i]);
-	for (size_t i = 0; i < c->fileops.size(); i++) {
-	    git_op &o = c->fileops[i];
-	    if (!o.mode.length() || !o.path.length())
-		continue;
-	    if (mode_map.find(o.path) != mode_map.end()) {
-		std::cout << "Setting mode of " << o.path << " to " << mode_map[o.path] << "\n";
-		o.mode = mode_map[o.path];
-	    }
-	}
+	commit_map_modes(&s->commits[i]);
     }
 
     return 0;
@@ -335,9 +450,13 @@ git_file_inserts(git_fi_data *s, std::string &mode_map_file)
 
 	git_op nop;
 	nop.type = filemodify;
-	nop.mode = file_array[1];
-	nop.dataref.sha1 = file_array[2];
-	nop.path = file_array[3];
+	nop.mode = git_mode_parse(file_array[1]);
+	nop.dataref.sha1 = git_oid(file_array[2]);
+	nop.path = s->paths.intern(file_array[3]);
+	if (nop.mode == mode_none || nop.dataref.sha1.is_null()) {
+	    std::cerr << "Invalid file insert line!: " << line << "\n";
+	    exit(-1);
+	}
 
 	file_insert_map[file_array[0]].push_back(nop);
     }
@@ -346,12 +465,12 @@ git_file_inserts(git_fi_data *s, std::string &mode_map_file)
     // associate additions with the commit.
     for (size_t i = 0; i < s->commits.size(); i++) {
 	git_commit_data *c = &(s->commits[i]);
-	if (!c->id.sha1.length())
+	if (c->id.sha1.is_null())
 	    continue;
-	if (file_insert_map.find(c->id.sha1) != file_insert_map.end()) {
-	    std::vector<git_op> &fv = file_insert_map[c->id.sha1];
+	if (file_insert_map.find(c->id.sha1.hex()) != file_insert_map.end()) {
+	    std::vector<git_op> &fv = file_insert_map[c->id.sha1.hex()];
 	    for (size_t j = 0; j < fv.size(); j++) {
-		std::cout << "Adding " << fv[j].path << " to " << c->id.sha1 << "\n";
+		std::cout << "Adding " << s->paths.str(fv[j].path) << " to " << c->id.sha1 << "\n";
 		c->fileops.push_back(fv[j]);
 	    }
 	}
@@ -375,14 +494,27 @@ process_ls_tree(std::string &sha1)
 
     std::string tline;
     while (std::getline(tfile, tline)) {
-	std::string ltree = tline;
-	std::regex bregex(" blob ");
-	std::string ltree2 = std::regex_replace(ltree, bregex, " ");
-	std::regex sregex("^");
-	ltree = std::regex_replace(ltree2, sregex , "M ");
-	std::regex tregex("\t");
-	ltree2 = std::regex_replace(ltree, tregex , " \"");
-	ofile << ltree2 << "\"\n";
+	// "<mode> blob <sha1>\t<path>" -> "M <mode> <sha1> \"<path>\""
+	std::string ltree("M ");
+	std::string_view tl(tline);
+	while (tl.length()) {
+	    size_t bpos = tl.find(" blob ");
+	    size_t tpos = tl.find('\t');
+	    if (bpos == std::string::npos && tpos == std::string::npos) {
+		ltree.append(tl);
+		break;
+	    }
+	    if (bpos < tpos) {
+		ltree.append(tl.substr(0, bpos));
+		ltree.append(" ");
+		tl.remove_prefix(bpos + 6);
+	    } else {
+		ltree.append(tl.substr(0, tpos));
+		ltree.append(" \"");
+		tl.remove_prefix(tpos + 1);
+	    }
+	}
+	ofile << ltree << "\"\n";
     }
 
     ofile.close();
@@ -390,11 +522,41 @@ process_ls_tree(std::string &sha1)
     std::remove("tree.txt");
 }
 
+// Original sha1s of the children of the commit with the given sha1 - those
+// in the input, along with any listed in the children file (which may know
+// of children the input doesn't have, if it is a partial export.)
+static std::set<std::string>
+commit_children(git_fi_data *s, const std::string &sha1, std::map<std::string, std::set<std::string>> &file_children)
+{
+    std::set<std::string> kids;
+    std::map<std::string, std::set<std::string>>::iterator f_it = file_children.find(sha1);
+    if (f_it != file_children.end())
+	kids = f_it->second;
+    long cind = commit_index(s, git_oid(sha1));
+    if (cind < 0)
+	return kids;
+    for (long ci : s->children.of(cind)) {
+	if (ci >= (long)s->commits.size())
+	    continue;
+	git_commit_data &c = s->commits[ci];
+	if (c.id.sha1.is_null())
+	    continue;
+	bool is_child = (c.from.index == cind);
+	for (size_t i = 0; i < c.merges.size(); i++)
+	    is_child = is_child || (c.merges[i].index == cind);
+	if (is_child)
+	    kids.insert(c.id.sha1.hex());
+    }
+    return kids;
+}
+
 int
 git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_path, std::string &child_commits_file)
 {
-    {
-	// read children
+    // Children are found from the input.  If we also have the output of
+    // "git rev-list --children", its children are added to those.
+    std::map<std::string, std::set<std::string>> file_children;
+    if (child_commits_file.length()) {
 	std::ifstream cfile(child_commits_file, std::ifstream::binary);
 	if (!cfile.good()) {
 	    std::cerr << "Could not open child_commits_file file: " << child_commits_file << "\n";
@@ -418,7 +580,7 @@ git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_p
 		rline.erase(0,41);
 	    }
 	    if (vals.size()) {
-		s->children[key] = vals;
+		file_children[key].insert(vals.begin(), vals.end());
 	    }
 	}
     }
@@ -441,11 +603,12 @@ git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_p
 	    std::string sha1;
 	    if (line.length() < 40) {
 		// Given an svn revision - translate it to a sha1
-		if (s->rev_to_sha1.find(line) == s->rev_to_sha1.end()) {
+		git_oid *roid = s->rev_to_sha1.find(line);
+		if (!roid) {
 		    std::cerr << "SVN revision " << line << " could not be mapped to SHA1.  May need to re-export fast import file with --show-original-ids.\n";
 		    exit(1);
 		}
-		sha1 = s->rev_to_sha1[line];
+		sha1 = roid->hex();
 	    } else {
 		sha1 = line;
 	    }
@@ -463,13 +626,12 @@ git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_p
 	std::string rb = *rbc.begin();
 	rbc.erase(rb);
 	std::cout << "Finding reset commit(s) for: " << rb << "\n";
-	if (s->children.find(rb) == s->children.end()) {
+	std::set<std::string> rc = commit_children(s, rb, file_children);
+	if (!rc.size()) {
 	    // No child commits - no further work needed.
 	    std::cout << "Leaf commit: " << rb << "\n";
 	    continue;
 	}
-	std::set<std::string>::iterator c_it;
-	std::set<std::string> rc = s->children[rb];
 	while (rc.size()) {
 	    std::string rcs = *rc.begin();
 	    rc.erase(rcs);
@@ -477,9 +639,8 @@ git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_p
 		std::cout << "found reset commit: " << rcs << "\n";
 		s->reset_commits.insert(rcs);
 	    } else {
-		if (s->children.find(rcs) != s->children.end()) {
-		    rc.insert(s->children[rcs].begin(), s->children[rcs].end());
-		}
+		std::set<std::string> gc = commit_children(s, rcs, file_children);
+		rc.insert(gc.begin(), gc.end());
 	    }
 	}
     }
@@ -490,9 +651,12 @@ git_id_rebuild_commits(git_fi_data *s, std::string &id_file, std::string &repo_p
     for (s_it = s->reset_commits.begin(); s_it != s->reset_commits.end(); s_it++) {
 	std::string sha1 = *s_it;
 	std::string git_ls_tree_cmd = std::string("cd ") + repo_path + std::string(" && git ls-tree --full-tree -r ") + sha1 + std::string(" > ../tree.txt && cd ..");
-	if (std::system(git_ls_tree_cmd.c_str())) {
-	    std::cout << "git_ls_tree_cmd \"" << git_ls_tree_cmd << "\" failed\n";
-	    exit(-1);
+	{
+	    fi_span span("git ls-tree", git_ls_tree_cmd);
+	    if (std::system(git_ls_tree_cmd.c_str())) {
+		std::cout << "git_ls_tree_cmd \"" << git_ls_tree_cmd << "\" failed\n";
+		exit(-1);
+	    }
 	}
 	process_ls_tree(sha1);
     }
@@ -0,0 +1,358 @@
+/*                      W R I T E R . C P P
+ * BRL-CAD
+ *
+ * Published in 2020 by the United States Government.
+ * This work is in the public domain.
+ *
+ */
+/** @file writer.cpp
+ *
+ * Output handling for fast-import streams.  Output is formatted into our
+ * own buffer and goes through a plain file descriptor rather than a
+ * std::filebuf, so blob contents can be moved from the input to the output
+ * by the kernel (copy_file_range, sendfile or splice) without ever being
+ * copied into our own memory.
+ *
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "repowork.h"
+
+#define FI_OUTBUF_SIZE (1024*1024)
+#define FI_OUTBUF_ALIGN 4096
+// Counted output is thrown away, so it only needs a cache sized buffer
+#define FI_COUNTBUF_SIZE (64*1024)
+
+/* Ways of moving data between descriptors, in order of preference */
+#define FI_COPY_FILE_RANGE 0
+#define FI_COPY_SENDFILE   1
+#define FI_COPY_SPLICE     2
+#define FI_COPY_READ       3
+
+// Pairs of decimal digits, for converting integers two digits at a time
+static const char fi_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+git_fi_writer::~git_fi_writer()
+{
+    close();
+}
+
+int
+git_fi_writer::open(const char *path)
+{
+    if (std::string_view(path) == std::string_view("-"))
+	return open_fd(STDOUT_FILENO, false);
+
+    int nfd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (nfd < 0) {
+	std::cerr << "Could not open output file: " << path << "\n";
+	return -1;
+    }
+    return open_fd(nfd, true);
+}
+
+int
+git_fi_writer::open_buf(int nfd, bool owned, size_t bsize)
+{
+    close();
+    void *m = NULL;
+    if (posix_memalign(&m, FI_OUTBUF_ALIGN, bsize)) {
+	std::cerr << "Could not allocate output buffer\n";
+	return -1;
+    }
+    ofd = nfd;
+    own_fd = owned;
+    counting = false;
+    failed = false;
+    nwritten = 0;
+    positioned = false;
+    woff = 0;
+    copy_fd = -1;
+    copy_method = FI_COPY_FILE_RANGE;
+    bstart = p = (char *)m;
+    bend = bstart + bsize;
+    return 0;
+}
+
+int
+git_fi_writer::open_fd(int nfd, bool owned)
+{
+    if (open_buf(nfd, owned, FI_OUTBUF_SIZE))
+	return -1;
+
+    // Output is written front to back (in buffer sized pieces) and never
+    // read back, which is worth letting the kernel know about.  (O_DIRECT
+    // isn't an option - records aren't block sized or aligned.)
+    struct stat sb;
+    if (fstat(ofd, &sb) == 0 && S_ISREG(sb.st_mode))
+	posix_fadvise(ofd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
+int
+git_fi_writer::open_at(int nfd, off_t offset)
+{
+    // (The descriptor belongs to whoever divided up the file, and has
+    // already had its hints.)
+    if (open_buf(nfd, false, FI_OUTBUF_SIZE))
+	return -1;
+    positioned = true;
+    woff = offset;
+    return 0;
+}
+
+int
+git_fi_writer::open_count()
+{
+    if (open_buf(-1, false, FI_COUNTBUF_SIZE))
+	return -1;
+    counting = true;
+    return 0;
+}
+
+int
+git_fi_writer::compress(fi_compression type, int nthreads)
+{
+    if (type == fi_compress_none)
+	return 0;
+    if (ofd < 0 || positioned) {
+	// Compressed output has to be written in order
+	return -1;
+    }
+    if (!flush_buf())
+	return -1;
+    comp = new fi_compressor;
+    if (comp->open(type, ofd, nthreads)) {
+	delete comp;
+	comp = NULL;
+	return -1;
+    }
+    // Everything goes through the compressor now, including blob contents
+    copy_fd = -1;
+    return 0;
+}
+
+int
+git_fi_writer::close()
+{
+    int ret = 0;
+    if (bstart) {
+	if (!flush_buf())
+	    ret = -1;
+	if (comp) {
+	    if (comp->close())
+		ret = -1;
+	    delete comp;
+	    comp = NULL;
+	}
+	if (ofd >= 0 && own_fd && ::close(ofd))
+	    ret = -1;
+	free(bstart);
+    }
+    ofd = -1;
+    own_fd = false;
+    bstart = bend = p = NULL;
+    return (failed) ? -1 : ret;
+}
+
+void
+git_fi_writer::put_num(unsigned long long v, bool neg)
+{
+    // Digits are generated from the end, two at a time
+    char tmp[24];
+    char *e = tmp + sizeof(tmp);
+    char *s = e;
+    while (v >= 100) {
+	size_t i = (v % 100) * 2;
+	v /= 100;
+	*--s = fi_digit_pairs[i + 1];
+	*--s = fi_digit_pairs[i];
+    }
+    if (v >= 10) {
+	size_t i = v * 2;
+	*--s = fi_digit_pairs[i + 1];
+	*--s = fi_digit_pairs[i];
+    } else {
+	*--s = (char)('0' + v);
+    }
+    if (neg)
+	*--s = '-';
+    write(s, e - s);
+}
+
+void
+git_fi_writer::write_long(const char *s, size_t n)
+{
+    if (!bstart || !flush_buf())
+	return;
+    if (n < (size_t)(bend - bstart)) {
+	memcpy(p, s, n);
+	p += n;
+	return;
+    }
+    // Too big for the buffer - write it directly rather than chopping it
+    // up into buffer sized pieces.
+    write_all(s, n);
+}
+
+// Write all of len bytes, retrying short writes
+bool
+git_fi_writer::write_all(const char *s, size_t len)
+{
+    if (counting) {
+	nwritten += len;
+	return true;
+    }
+    if (comp) {
+	if (failed || !comp->write(s, len)) {
+	    failed = true;
+	    return false;
+	}
+	nwritten += len;
+	return true;
+    }
+    while (len && !failed) {
+	ssize_t r = (positioned) ? pwrite(ofd, s, len, woff) : ::write(ofd, s, len);
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r <= 0) {
+	    std::cerr << "Error writing output\n";
+	    failed = true;
+	    break;
+	}
+	if (positioned)
+	    woff += r;
+	nwritten += r;
+	s += r;
+	len -= r;
+    }
+    return !failed;
+}
+
+bool
+git_fi_writer::flush_buf()
+{
+    size_t len = p - bstart;
+    if (!len)
+	return !failed;
+    bool ret = write_all(bstart, len);
+    p = bstart;
+    return ret;
+}
+
+size_t
+git_fi_writer::copy_from(int infd, off_t *offset, size_t n)
+{
+    if (!bstart || !flush_buf())
+	return 0;
+
+    // Counted output only needs the input moved past
+    if (counting && offset) {
+	*offset += n;
+	nwritten += n;
+	return n;
+    }
+
+    // Methods that failed for this input don't get retried for every blob
+    if (infd != copy_fd) {
+	copy_fd = infd;
+	copy_method = (counting || comp) ? FI_COPY_READ : FI_COPY_FILE_RANGE;
+    }
+
+    size_t copied = 0;
+    while (copied < n) {
+	size_t want = n - copied;
+	ssize_t r = -1;
+	switch (copy_method) {
+	    case FI_COPY_FILE_RANGE:
+		r = copy_file_range(infd, offset, ofd, (positioned) ? &woff : NULL, want, 0);
+		break;
+	    case FI_COPY_SENDFILE:
+	    case FI_COPY_SPLICE:
+		// These write at the descriptor's file position, which
+		// positioned output doesn't use
+		if (positioned) {
+		    errno = ESPIPE;
+		    break;
+		}
+		if (copy_method == FI_COPY_SENDFILE) {
+		    r = sendfile(ofd, infd, offset, want);
+		} else {
+		    r = splice(infd, offset, ofd, NULL, want, SPLICE_F_MOVE);
+		}
+		break;
+	    default:
+		{
+		    // Plain old read and write
+		    char cbuf[65536];
+		    size_t clen = std::min(want, sizeof(cbuf));
+		    r = (offset) ? pread(infd, cbuf, clen, *offset) : ::read(infd, cbuf, clen);
+		    if (r > 0) {
+			if (!write_all(cbuf, r))
+			    return copied;
+			if (offset)
+			    *offset += r;
+		    }
+		}
+		break;
+	}
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r < 0 && copy_method != FI_COPY_READ) {
+	    // This pairing of descriptors doesn't support the method - try
+	    // the next one.  A failed call doesn't move any data, so it is
+	    // safe to switch even part way through.
+	    copy_method++;
+	    continue;
+	}
+	if (r < 0) {
+	    std::cerr << "Error copying data to output\n";
+	    failed = true;
+	    break;
+	}
+	if (r == 0 && copy_method != FI_COPY_READ) {
+	    // Some filesystems report nothing copied rather than an error
+	    // when they can't do it - let the fallbacks decide whether we
+	    // really are out of input.
+	    copy_method++;
+	    continue;
+	}
+	if (r == 0) {
+	    // Out of input
+	    break;
+	}
+	if (copy_method != FI_COPY_READ) {
+	    // (write_all has already counted anything read and written)
+	    nwritten += r;
+	}
+	copied += r;
+    }
+
+    return copied;
+}
+
+// Local Variables:
+// tab-width: 8
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: t
+// c-file-style: "stroustrup"
+// End:
+// ex: shiftwidth=4 tabstop=8